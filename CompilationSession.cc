@@ -0,0 +1,73 @@
+#include "CompilationSession.h"
+#include "fmt/format.h"
+#include "slang/ast/symbols/CompilationUnitSymbols.h"
+#include "slang/ast/symbols/InstanceSymbols.h"
+#include <memory>
+
+using namespace slang;
+using namespace slang::syntax;
+using namespace slang::ast;
+
+namespace slang_common {
+
+CompilationSession::CompilationSession(const Bag &options) : comp(std::make_unique<Compilation>(options)), instances(*comp) {}
+
+CompilationSession::CompilationSession(std::shared_ptr<SyntaxTree> tree, const Bag &options) : CompilationSession(options) { addSyntaxTree(std::move(tree)); }
+
+void CompilationSession::addSyntaxTree(std::shared_ptr<SyntaxTree> tree) {
+    comp->addSyntaxTree(tree);
+    trees.push_back(std::move(tree));
+}
+
+const DefinitionSymbol *CompilationSession::getDefinition(const ModuleDeclarationSyntax &syntax) {
+    if (auto it = definitions.find(&syntax); it != definitions.end()) {
+        return it->second;
+    }
+
+    auto def = slang_common::getDefSymbol(*comp, syntax);
+    if (def != nullptr) {
+        definitions.emplace(&syntax, def);
+    }
+    return def;
+}
+
+const InstanceSymbol *CompilationSession::getInstance(const ModuleDeclarationSyntax &syntax) {
+    auto def = getDefinition(syntax);
+    if (def == nullptr) {
+        return nullptr;
+    }
+    return &instances.get(def->as<DefinitionSymbol>());
+}
+
+const DefinitionIndex &CompilationSession::definitionIndex() {
+    if (index == nullptr) {
+        index = std::make_unique<DefinitionIndex>(*comp);
+    }
+    return *index;
+}
+
+SemanticModel &CompilationSession::semanticModel() {
+    if (model == nullptr) {
+        model = std::make_unique<SemanticModel>(*comp, instances);
+    }
+    return *model;
+}
+
+void listAST(CompilationSession &session, const ListOptions &options) { listAST(session.compilation(), options); }
+
+void listASTNode(CompilationSession &session, const ModuleDeclarationSyntax &syntax, const ListOptions &options) {
+    auto inst = session.getInstance(syntax);
+    if (inst == nullptr) {
+        fmt::println(stderr, "[listASTNode] no definition for: {}", syntax.header->name.rawText());
+        return;
+    }
+    listASTNode(*inst, options);
+}
+
+const DefinitionSymbol *getDefSymbol(CompilationSession &session, const ModuleDeclarationSyntax &syntax) { return session.getDefinition(syntax); }
+
+const InstanceSymbol *getInstSymbol(CompilationSession &session, const ModuleDeclarationSyntax &syntax) { return session.getInstance(syntax); }
+
+DesignStats collectDesignStats(CompilationSession &session) { return collectDesignStats(session.compilation()); }
+
+} // namespace slang_common
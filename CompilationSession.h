@@ -0,0 +1,74 @@
+#pragma once
+
+#include "SemanticModel.h"
+#include "SlangCommon.h"
+#include "slang/ast/Compilation.h"
+#include "slang/syntax/AllSyntax.h"
+#include "slang/syntax/SyntaxTree.h"
+#include <memory>
+#include <vector>
+
+using namespace slang;
+using namespace slang::syntax;
+using namespace slang::ast;
+
+namespace slang_common {
+
+// Owns the syntax trees of a design, the one Compilation elaborating them and the lookups made against it, so
+// repeated queries reuse a single elaboration and every returned symbol stays valid for the session's lifetime.
+// Add all trees before the first query: a Compilation cannot take new trees once it has been elaborated.
+class CompilationSession {
+  public:
+    explicit CompilationSession(const Bag &options = {});
+
+    explicit CompilationSession(std::shared_ptr<SyntaxTree> tree, const Bag &options = {});
+
+    CompilationSession(const CompilationSession &)            = delete;
+    CompilationSession &operator=(const CompilationSession &) = delete;
+
+    void addSyntaxTree(std::shared_ptr<SyntaxTree> tree);
+
+    const std::vector<std::shared_ptr<SyntaxTree>> &syntaxTrees() const { return trees; }
+
+    Compilation &compilation() { return *comp; }
+
+    // Memoized per declaration.
+    const DefinitionSymbol *getDefinition(const ModuleDeclarationSyntax &syntax);
+
+    // The default (parameters at their defaults) instance of the declaration, created once per definition.
+    const InstanceSymbol *getInstance(const ModuleDeclarationSyntax &syntax);
+
+    DefaultInstanceCache &instanceCache() { return instances; }
+
+    // Built on first use, i.e. once all trees have been added.
+    const DefinitionIndex &definitionIndex();
+
+    DeclarationIndex &declarationIndex() { return declarations; }
+
+    // Created on first use, so its symbol cache is shared by all callers of the session. It uses the session's
+    // instance cache, so it resolves into the same instances getInstance returns.
+    SemanticModel &semanticModel();
+
+  private:
+    std::vector<std::shared_ptr<SyntaxTree>> trees;
+    std::unique_ptr<Compilation> comp;
+    DefaultInstanceCache instances;
+    std::unique_ptr<SemanticModel> model;
+    std::unique_ptr<DefinitionIndex> index;
+    DeclarationIndex declarations;
+    flat_hash_map<const ModuleDeclarationSyntax *, const DefinitionSymbol *> definitions;
+};
+
+// The SlangCommon queries against a session instead of a throwaway Compilation.
+
+void listAST(CompilationSession &session, const ListOptions &options = {});
+
+void listASTNode(CompilationSession &session, const ModuleDeclarationSyntax &syntax, const ListOptions &options = {});
+
+const DefinitionSymbol *getDefSymbol(CompilationSession &session, const ModuleDeclarationSyntax &syntax);
+
+const InstanceSymbol *getInstSymbol(CompilationSession &session, const ModuleDeclarationSyntax &syntax);
+
+DesignStats collectDesignStats(CompilationSession &session);
+
+} // namespace slang_common
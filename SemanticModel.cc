@@ -1,5 +1,8 @@
 #include <cassert>
+#include <cstdint>
 #include <iostream>
+#include <mutex>
+#include <shared_mutex>
 #include "SemanticModel.h"
 #include "fmt/color.h"
 #include "slang/ast/Symbol.h"
@@ -13,21 +16,68 @@ using namespace slang::syntax;
 using namespace slang::ast;
 
 // clang-format off
+SemanticModel::SemanticModel(Compilation& compilation, bool concurrent)
+    : compilation(compilation), ownedInstances(std::make_unique<slang_common::DefaultInstanceCache>(compilation)),
+      instances(*ownedInstances), concurrent(concurrent) {
+    if (concurrent)
+        prepareConcurrent();
+}
+
+SemanticModel::SemanticModel(Compilation& compilation, slang_common::DefaultInstanceCache& instances, bool concurrent)
+    : compilation(compilation), instances(instances), concurrent(concurrent) {
+    if (concurrent)
+        prepareConcurrent();
+}
+
+void SemanticModel::prepareConcurrent() {
+    // Elaborate the design, then resolve every module, interface and program declaration to its default instance
+    // and elaborate that fully. After this no query creates or elaborates anything in the compilation.
+    compilation.getAllDiagnostics();
+
+    std::vector<const SyntaxNode*> pending;
+    for (auto& tree : compilation.getSyntaxTrees())
+        pending.push_back(&tree->root());
+
+    while (!pending.empty()) {
+        auto node = pending.back();
+        pending.pop_back();
+
+        if (node->kind == SyntaxKind::ModuleDeclaration ||
+            node->kind == SyntaxKind::InterfaceDeclaration ||
+            node->kind == SyntaxKind::ProgramDeclaration) {
+            if (auto inst = getDeclaredSymbol(*node))
+                compilation.forceElaborate(*inst);
+        }
+
+        for (uint32_t i = 0; i < node->getChildCount(); i++) {
+            auto child = node->childNode(i);
+            if (child && !ExpressionSyntax::isKind(child->kind))
+                pending.push_back(child);
+        }
+    }
+
+    readOnly = true;
+}
+
 const Symbol* SemanticModel::getDeclaredSymbol(const syntax::SyntaxNode& syntax) {
     // If we've already cached this node, return that.
-    if (auto it = symbolCache.find(&syntax); it != symbolCache.end())
-        return it->second;
+    if (auto cached = findCached(syntax))
+        return cached;
 
     // If we hit the top of the syntax tree, look in the compilation for the correct symbol.
     if (syntax.kind == SyntaxKind::CompilationUnit) {
         auto result = compilation.getCompilationUnit(syntax.as<CompilationUnitSyntax>());
         if (result)
-            symbolCache[&syntax] = result;
+            cacheSymbol(syntax, result);
         return result;
     }
     else if (syntax.kind == SyntaxKind::ModuleDeclaration ||
              syntax.kind == SyntaxKind::InterfaceDeclaration ||
              syntax.kind == SyntaxKind::ProgramDeclaration) {
+        // A prepared concurrent model resolved all of these up front, a miss has no definition.
+        if (readOnly)
+            return nullptr;
+
         auto [parentScope, parentSym] = getParent(syntax);
         if (!parentScope)
             parentScope = &compilation.getRoot();
@@ -40,11 +90,32 @@ const Symbol* SemanticModel::getDeclaredSymbol(const syntax::SyntaxNode& syntax)
         // fmt::println("[SemanticModel] defName: {}", def->name);
 
         // There is no symbol to use here so create a placeholder instance.
-        auto result = &InstanceSymbol::createDefault(compilation, *def);
-        symbolCache[&syntax] = result;
+        auto result = &instances.get(*def);
+        cacheSymbol(syntax, result);
         return result;
     }
 
+    // Net and variable declarations have no symbol of their own: each declarator becomes a member of the
+    // scope enclosing the declaration. A whole declaration resolves to the symbol of its first declarator.
+    if (syntax.kind == SyntaxKind::NetDeclaration || syntax.kind == SyntaxKind::DataDeclaration) {
+        auto [parentScope, parentSym] = getParent(syntax);
+        auto first = firstDeclarator(syntax);
+        if (!parentScope || !first)
+            return nullptr;
+
+        auto result = findMember(*parentScope, *first);
+        if (result)
+            cacheSymbol(syntax, result);
+        return result;
+    }
+    else if (syntax.kind == SyntaxKind::Declarator && syntax.parent &&
+             (syntax.parent->kind == SyntaxKind::NetDeclaration || syntax.parent->kind == SyntaxKind::DataDeclaration)) {
+        auto [parentScope, parentSym] = getParent(*syntax.parent);
+        if (!parentScope)
+            return nullptr;
+        return findMember(*parentScope, syntax);
+    }
+
     // Otherwise try to find the parent symbol first.
     auto [parentScope, parentSym] = getParent(syntax);
     if (!parentSym)
@@ -54,7 +125,7 @@ const Symbol* SemanticModel::getDeclaredSymbol(const syntax::SyntaxNode& syntax)
     if (parentSym->kind == SymbolKind::TypeAlias) {
         auto& target = parentSym->as<TypeAliasType>().targetType.getType();
         if (target.getSyntax() == &syntax) {
-            symbolCache.emplace(&syntax, &target);
+            cacheSymbol(syntax, &target);
             return &target;
         }
         return nullptr;
@@ -64,26 +135,103 @@ const Symbol* SemanticModel::getDeclaredSymbol(const syntax::SyntaxNode& syntax)
         return nullptr;
 
     // Search among the parent's children to see if we can find ourself.
-    for (auto& child : parentScope->members()) {
-        // fmt::println("[SemanticModel] synKind: {} <==> {}", toString(child.getSyntax()->kind), toString(syntax.kind));
-        if (child.getSyntax() == &syntax) {
-            // We found ourselves, hurray.
-            symbolCache.emplace(&syntax, &child);
-            return &child;
-        }
+    return findMember(*parentScope, syntax);
+}
 
-        if(syntax.kind == SyntaxKind::NetDeclaration) {
-            auto &syntax_1 = syntax.as<NetDeclarationSyntax>();
-            auto syntax_2 = syntax_1.declarators[0];
-            if(child.getSyntax() == syntax_2) {
-                fmt::println("found! => {}", syntax_2->name.rawText());
-                return &child;
-                // assert(false);
-            }
+const Symbol* SemanticModel::findMember(const Scope& scope, const SyntaxNode& syntax) {
+    // Index all of the scope's children by syntax the first time we look into it, so this lookup
+    // and every later one of a sibling is a single probe of the cache.
+    // The scope is only marked once all of it is in the cache, so no thread sees it indexed early. Threads racing
+    // on the same scope index it twice, which is harmless.
+    if (!isIndexed(scope)) {
+        for (auto& child : scope.members()) {
+            if (auto childSyntax = child.getSyntax())
+                cacheSymbol(*childSyntax, &child);
         }
+        markIndexed(scope);
+    }
+
+    return findCached(syntax);
+}
+
+SemanticModel::CacheShard& SemanticModel::shardFor(const void* key) {
+    // Nodes are allocated close together, mix the address so neighbours land in different shards.
+    auto hash = (reinterpret_cast<uintptr_t>(key) >> 3) * 0x9E3779B97F4A7C15ull;
+    return shards[(hash >> 32) % shardCount];
+}
+
+const Symbol* SemanticModel::findCached(const syntax::SyntaxNode& syntax) {
+    auto& shard = shardFor(&syntax);
+    std::shared_lock lock(shard.mutex, std::defer_lock);
+    if (concurrent)
+        lock.lock();
+
+    auto it = shard.symbols.find(&syntax);
+    return it != shard.symbols.end() ? it->second : nullptr;
+}
+
+void SemanticModel::cacheSymbol(const syntax::SyntaxNode& syntax, const Symbol* symbol) {
+    auto& shard = shardFor(&syntax);
+    std::unique_lock lock(shard.mutex, std::defer_lock);
+    if (concurrent)
+        lock.lock();
+
+    shard.symbols.emplace(&syntax, symbol);
+}
+
+bool SemanticModel::isIndexed(const Scope& scope) {
+    auto& shard = shardFor(&scope);
+    std::shared_lock lock(shard.mutex, std::defer_lock);
+    if (concurrent)
+        lock.lock();
+
+    return shard.indexedScopes.contains(&scope);
+}
+
+void SemanticModel::markIndexed(const Scope& scope) {
+    auto& shard = shardFor(&scope);
+    std::unique_lock lock(shard.mutex, std::defer_lock);
+    if (concurrent)
+        lock.lock();
+
+    shard.indexedScopes.insert(&scope);
+}
+
+const DeclaratorSyntax* SemanticModel::firstDeclarator(const SyntaxNode& declaration) {
+    auto& declarators = declaration.kind == SyntaxKind::NetDeclaration ? declaration.as<NetDeclarationSyntax>().declarators
+                                                                       : declaration.as<DataDeclarationSyntax>().declarators;
+    return declarators.empty() ? nullptr : declarators[0];
+}
+
+std::vector<const Symbol*> SemanticModel::getDeclaredSymbols(std::span<const syntax::SyntaxNode* const> nodes, unsigned threads) {
+    // Group by the node the scope is looked up from: the parent, or for declarators the declaration's parent.
+    flat_hash_map<const SyntaxNode*, size_t> groupOf;
+    std::vector<std::vector<size_t>> groups;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        auto key = nodes[i]->parent;
+        if (nodes[i]->kind == SyntaxKind::Declarator && key)
+            key = key->parent;
+
+        auto [it, inserted] = groupOf.try_emplace(key, groups.size());
+        if (inserted)
+            groups.emplace_back();
+        groups[it->second].push_back(i);
     }
 
-    return nullptr;
+    std::vector<const Symbol*> results(nodes.size());
+    auto resolveGroup = [&](size_t group) {
+        for (auto i : groups[group])
+            results[i] = getDeclaredSymbol(*nodes[i]);
+    };
+
+    if (threads != 1 && concurrent) {
+        slang_common::parallelFor(groups.size(), threads, resolveGroup);
+    }
+    else {
+        for (size_t group = 0; group < groups.size(); group++)
+            resolveGroup(group);
+    }
+    return results;
 }
 
 const CompilationUnitSymbol* SemanticModel::getDeclaredSymbol(const CompilationUnitSyntax& syntax) {
@@ -132,8 +280,9 @@ const TypeAliasType* SemanticModel::getDeclaredSymbol(const TypedefDeclarationSy
 }
 
 const NetSymbol* SemanticModel::getDeclaredSymbol(const DeclaratorSyntax& syntax) {
+    // Declarators of variables resolve too, use the SyntaxNode overload for those.
     auto result = getDeclaredSymbol((const SyntaxNode&)syntax);
-    return result ? &result->as<NetSymbol>() : nullptr;
+    return result && result->kind == SymbolKind::Net ? &result->as<NetSymbol>() : nullptr;
 }
 
 std::pair<const Scope*, const Symbol*> SemanticModel::getParent(const SyntaxNode& syntax) {
@@ -159,26 +308,72 @@ const InstanceSymbol *SemanticModel::syntaxToInstanceSymbol(const syntax::Syntax
             assert(false && "cannot found any module declaration syntax!");
         }
     }
+    // Same instance as getDeclaredSymbol, which a prepared concurrent model has cached for every declaration.
+    if (auto cached = findCached(*currSyntax))
+        return &cached->as<InstanceSymbol>();
+    if (readOnly)
+        return nullptr;
+
     auto r      = &compilation.getRoot();
     auto &rs    = r->as<Scope>();
     auto def    = compilation.getDefinition(rs, currSyntax->as<ModuleDeclarationSyntax>());
-    auto result = &InstanceSymbol::createDefault(compilation, *def);
+    auto result = &instances.get(*def);
     return result;
 }
 
-const NetSymbol &SemanticModel::getNetSymbol(const InstanceSymbol *instSym, std::string_view identifierName) {
-    for (auto &sym : instSym->body.members()) {
-        if (sym.kind == SymbolKind::Net) {
-            auto &netSym = sym.as<NetSymbol>();
-            if (netSym.name == identifierName) {
-                return netSym;
-            }
+const NetSymbol *SemanticModel::getNetSymbol(const InstanceSymbol *instSym, std::string_view identifierName) {
+    auto entry = findBodyMember(instSym->body, identifierName);
+    if (entry == nullptr || entry->value == nullptr || entry->value->kind != SymbolKind::Net)
+        return nullptr;
+    return &entry->value->as<NetSymbol>();
+}
+
+const Symbol *SemanticModel::getMemberSymbol(const InstanceSymbol *instSym, std::string_view identifierName) {
+    auto entry = findBodyMember(instSym->body, identifierName);
+    if (entry == nullptr)
+        return nullptr;
+    return entry->value ? entry->value : entry->port;
+}
+
+const SemanticModel::BodyMember *SemanticModel::findBodyMember(const InstanceBodySymbol &body, std::string_view name) {
+    auto& names = bodyIndex(body);
+    auto it = names.find(name);
+    return it != names.end() ? &it->second : nullptr;
+}
+
+const SemanticModel::BodyNameMap &SemanticModel::bodyIndex(const InstanceBodySymbol &body) {
+    {
+        std::shared_lock lock(bodyIndexMutex, std::defer_lock);
+        if (concurrent)
+            lock.lock();
+        if (auto it = bodyIndexes.find(&body); it != bodyIndexes.end())
+            return *it->second;
+    }
+
+    // Built outside the lock; a thread that loses the race to insert drops its copy.
+    auto names = std::make_unique<BodyNameMap>();
+    for (auto &sym : body.members()) {
+        switch (sym.kind) {
+        case SymbolKind::Net:
+        case SymbolKind::Variable:
+        case SymbolKind::Parameter:
+        case SymbolKind::TypeParameter:
+            (*names)[sym.name].value = &sym;
+            break;
+        case SymbolKind::Port:
+        case SymbolKind::MultiPort:
+        case SymbolKind::InterfacePort:
+            (*names)[sym.name].port = &sym;
+            break;
+        default:
+            break;
         }
     }
 
-    std::cout << "Assertion failed: Not found NetSymbol! " 
-                << "Identifier: " << identifierName << std::endl;
-        
-    assert(false);
+    std::unique_lock lock(bodyIndexMutex, std::defer_lock);
+    if (concurrent)
+        lock.lock();
+    auto [it, inserted] = bodyIndexes.try_emplace(&body, std::move(names));
+    return *it->second;
 }
 // clang-format on
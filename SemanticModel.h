@@ -2,6 +2,11 @@
 
 #include "SlangCommon.h"
 #include "slang/syntax/AllSyntax.h"
+#include <array>
+#include <memory>
+#include <shared_mutex>
+#include <span>
+#include <vector>
 
 using namespace std;
 using namespace slang;
@@ -11,7 +16,14 @@ using namespace slang::ast;
 class SemanticModel {
 
   public:
-    explicit SemanticModel(Compilation &compilation) : compilation(compilation) {}
+    // A concurrent model may be shared by threads calling its lookups at the same time. Its constructor elaborates
+    // the whole design and creates and fully elaborates the default instance of every module, interface and program
+    // declaration up front, so that afterwards lookups only read the compilation (and may run after freeze()).
+    explicit SemanticModel(Compilation &compilation, bool concurrent = false);
+
+    // Shares the default instances with other users of the cache, e.g. a CompilationSession. Nothing else may use
+    // the compilation or the cache while a concurrent model is being queried.
+    SemanticModel(Compilation &compilation, slang_common::DefaultInstanceCache &instances, bool concurrent = false);
 
     const Symbol *getDeclaredSymbol(const syntax::SyntaxNode &syntax);
 
@@ -33,15 +45,76 @@ class SemanticModel {
 
     const TypeAliasType *getDeclaredSymbol(const TypedefDeclarationSyntax &syntax);
 
+    // nullptr if the declarator does not declare a net.
     const NetSymbol *getDeclaredSymbol(const DeclaratorSyntax &syntax);
 
+    // Resolves many nodes at once, results in input order (nullptr where getDeclaredSymbol has none). Nodes are
+    // grouped by the syntax their scope comes from, so each scope is resolved and indexed once per group and the
+    // rest of the group are cache hits. With threads != 1 (0: one per hardware thread) the groups are resolved in
+    // parallel; that needs a concurrent model, otherwise they are resolved on the calling thread.
+    std::vector<const Symbol *> getDeclaredSymbols(std::span<const syntax::SyntaxNode *const> nodes, unsigned threads = 1);
+
     const InstanceSymbol *syntaxToInstanceSymbol(const syntax::SyntaxNode &syntax);
     
-    const NetSymbol &getNetSymbol(const InstanceSymbol *instSym, std::string_view identifierName);
+    // Looked up in an index of the instance body's members built on first use. nullptr if the body declares no
+    // net of that name.
+    const NetSymbol *getNetSymbol(const InstanceSymbol *instSym, std::string_view identifierName);
+
+    // The net, variable or parameter of that name in the instance body, else the port of that name (e.g. an
+    // interface port), else nullptr.
+    const Symbol *getMemberSymbol(const InstanceSymbol *instSym, std::string_view identifierName);
 
   private:
     std::pair<const Scope *, const Symbol *> getParent(const SyntaxNode &syntax);
 
+    const Symbol *findMember(const Scope &scope, const SyntaxNode &syntax);
+
+    static const DeclaratorSyntax *firstDeclarator(const SyntaxNode &declaration);
+
+    void prepareConcurrent();
+
+    // The symbol cache is split into shards with a lock each, so threads looking up different nodes rarely contend
+    // and lookups only share their shard's lock. The locks are only taken in concurrent mode.
+    struct CacheShard {
+        std::shared_mutex mutex;
+        flat_hash_map<const syntax::SyntaxNode *, const Symbol *> symbols;
+        flat_hash_set<const Scope *> indexedScopes;
+    };
+
+    static constexpr size_t shardCount = 64;
+
+    CacheShard &shardFor(const void *key);
+
+    const Symbol *findCached(const syntax::SyntaxNode &syntax);
+
+    void cacheSymbol(const syntax::SyntaxNode &syntax, const Symbol *symbol);
+
+    bool isIndexed(const Scope &scope);
+
+    void markIndexed(const Scope &scope);
+
+    // Members of an instance body by name. A port and the net or variable behind it share a name, so both are kept.
+    struct BodyMember {
+        const Symbol *value = nullptr;
+        const Symbol *port  = nullptr;
+    };
+
+    using BodyNameMap = flat_hash_map<std::string_view, BodyMember>;
+
+    const BodyMember *findBodyMember(const InstanceBodySymbol &body, std::string_view name);
+
+    const BodyNameMap &bodyIndex(const InstanceBodySymbol &body);
+
     Compilation &compilation;
-    flat_hash_map<const syntax::SyntaxNode *, const Symbol *> symbolCache;
+    std::unique_ptr<slang_common::DefaultInstanceCache> ownedInstances;
+    slang_common::DefaultInstanceCache &instances;
+    const bool concurrent;
+
+    // Set once a concurrent model is prepared: lookups that would create an instance return nullptr instead.
+    bool readOnly = false;
+    std::array<CacheShard, shardCount> shards;
+
+    // Guarded by bodyIndexMutex in concurrent mode. The maps are boxed so references to them survive rehashing.
+    std::shared_mutex bodyIndexMutex;
+    flat_hash_map<const InstanceBodySymbol *, std::unique_ptr<BodyNameMap>> bodyIndexes;
 };
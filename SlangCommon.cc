@@ -13,100 +13,1185 @@
 #include "slang/syntax/SyntaxNode.h"
 #include "slang/syntax/SyntaxTree.h"
 #include "slang/util/LanguageVersion.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <functional>
 #include <memory>
+#include <optional>
+#include <regex>
 #include <string>
+#include <thread>
 
-#include <boost/type_index.hpp>
+#include <cerrno>
+#include <iterator>
 #include <type_traits>
+#include <unistd.h>
+
+// mallinfo2 arrived with glibc 2.33; older glibc only has mallinfo, whose int fields wrap past 2 GiB.
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 33)
+#include <malloc.h>
+#define HAVE_MALLINFO2 1
+#endif
+#endif
 
 using namespace slang;
 using namespace slang::parsing;
 using namespace slang::syntax;
 using namespace slang::ast;
 
-namespace slang_common {
-bool checkDiagsError(Diagnostics &diags) {
-    for (auto &diag : diags) {
-        if (diag.isError()) {
-            return true;
+namespace slang_common {
+bool checkDiagsError(Diagnostics &diags) {
+    for (auto &diag : diags) {
+        if (diag.isError()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Bytes currently allocated from the heap by the whole process, only available with glibc 2.33 or newer.
+static int64_t heapInUse() {
+#if defined(HAVE_MALLINFO2)
+    return static_cast<int64_t>(mallinfo2().uordblks);
+#else
+    return 0;
+#endif
+}
+
+class TokenCounter : public SyntaxVisitor<TokenCounter> {
+  public:
+    uint64_t count = 0;
+
+    void visitToken(Token) { count++; }
+};
+
+// Runs `func` as one named phase of a rebuild and appends its timing to `stats`. Heap growth is only sampled
+// for detailed stats since mallinfo2() is not free; it is process-wide, so concurrent rebuilds blur it.
+template <typename TFunc> static auto recordPhase(RebuildStats &stats, bool detailed, std::string_view name, TFunc &&func) {
+    RebuildPhase phase;
+    phase.name      = name;
+    auto heapBefore = detailed ? heapInUse() : 0;
+    phase.start     = std::chrono::steady_clock::now();
+
+    auto finish = [&] {
+        phase.duration = std::chrono::steady_clock::now() - phase.start;
+        if (detailed) {
+            phase.heapBytes = heapInUse() - heapBefore;
+        }
+        stats.phases.push_back(phase);
+    };
+
+    if constexpr (std::is_void_v<decltype(func())>) {
+        func();
+        finish();
+    } else {
+        auto result = func();
+        finish();
+        return result;
+    }
+}
+
+// Declarations that define something elaborated as a top module; packages share the syntax but are not.
+static bool isDefinitionKind(SyntaxKind kind) { return kind == SyntaxKind::ModuleDeclaration || kind == SyntaxKind::InterfaceDeclaration || kind == SyntaxKind::ProgramDeclaration; }
+
+static bool isModuleLike(SyntaxKind kind) { return isDefinitionKind(kind) || kind == SyntaxKind::PackageDeclaration; }
+
+// The definitions of a tree and, for each definition name, the definitions that instantiate it, read off the syntax.
+class InstantiationCollector : public SyntaxVisitor<InstantiationCollector> {
+  public:
+    flat_hash_map<std::string_view, const ModuleDeclarationSyntax *> definitions;
+    flat_hash_map<std::string_view, std::vector<std::string_view>> parents;
+
+    void handle(const ModuleDeclarationSyntax &syntax) {
+        if (!isDefinitionKind(syntax.kind)) {
+            return;
+        }
+        auto name = syntax.header->name.rawText();
+        definitions.emplace(name, &syntax);
+        enclosing.push_back(name);
+        visitDefault(syntax);
+        enclosing.pop_back();
+    }
+
+    void handle(const HierarchyInstantiationSyntax &syntax) {
+        if (!enclosing.empty()) {
+            parents[syntax.type.rawText()].push_back(enclosing.back());
+        }
+        visitDefault(syntax);
+    }
+
+  private:
+    std::vector<std::string_view> enclosing;
+};
+
+static bool isInterfacePort(const SyntaxNode &port) {
+    if (port.kind == SyntaxKind::ImplicitAnsiPort) {
+        return port.as<ImplicitAnsiPortSyntax>().header->kind == SyntaxKind::InterfacePortHeader;
+    }
+    if (port.kind == SyntaxKind::PortDeclaration) {
+        return port.as<PortDeclarationSyntax>().header->kind == SyntaxKind::InterfacePortHeader;
+    }
+    return false;
+}
+
+// Whether slang can elaborate the definition as a top module: every parameter needs a default and no port may be an
+// interface port.
+static bool canBeTop(const ModuleDeclarationSyntax &syntax) {
+    if (auto parameters = syntax.header->parameters) {
+        for (auto declaration : parameters->declarations) {
+            if (declaration->kind == SyntaxKind::ParameterDeclaration) {
+                for (auto declarator : declaration->as<ParameterDeclarationSyntax>().declarators) {
+                    if (declarator->initializer == nullptr) {
+                        return false;
+                    }
+                }
+            } else if (declaration->kind == SyntaxKind::TypeParameterDeclaration) {
+                for (auto declarator : declaration->as<TypeParameterDeclarationSyntax>().declarators) {
+                    if (declarator->assignment == nullptr) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    if (auto ports = syntax.header->ports; ports != nullptr && ports->kind == SyntaxKind::AnsiPortList) {
+        for (auto port : ports->as<AnsiPortListSyntax>().ports) {
+            if (isInterfacePort(*port)) {
+                return false;
+            }
+        }
+    }
+    for (auto member : syntax.members) {
+        if (isInterfacePort(*member)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The top modules that elaborate every touched definition in the context it is instantiated in: the uninstantiated
+// definitions above each touched one. Empty (meaning the whole design) if one of them cannot be a top or is not
+// defined in the tree.
+static std::vector<std::string_view> validationTops(const SyntaxTree &tree, std::span<const std::string_view> touched, const std::vector<std::string> &touchedDefinitions) {
+    InstantiationCollector collector;
+    tree.root().visit(collector);
+
+    std::vector<std::string_view> pending(touched.begin(), touched.end());
+    pending.insert(pending.end(), touchedDefinitions.begin(), touchedDefinitions.end());
+
+    flat_hash_set<std::string_view> seen;
+    std::vector<std::string_view> tops;
+    while (!pending.empty()) {
+        auto name = pending.back();
+        pending.pop_back();
+        if (!seen.insert(name).second) {
+            continue;
+        }
+
+        if (auto it = collector.parents.find(name); it != collector.parents.end()) {
+            pending.insert(pending.end(), it->second.begin(), it->second.end());
+            continue;
+        }
+
+        auto definition = collector.definitions.find(name);
+        if (definition == collector.definitions.end() || !canBeTop(*definition->second)) {
+            return {};
+        }
+        tops.push_back(name);
+    }
+    return tops;
+}
+
+// Runs the checks selected by options.validation on a rebuilt tree. The diagnostics of a failing stage are rendered
+// right away, while the Compilation they may refer to is still alive.
+static void validateRebuiltTree(const std::shared_ptr<SyntaxTree> &newTree, const RebuildOptions &options, std::span<const std::string_view> touched, RebuildResult &result) {
+    if (options.validation == ValidationLevel::None) {
+        return;
+    }
+
+    auto start          = std::chrono::steady_clock::now();
+    auto &sourceManager = newTree->sourceManager();
+    if (newTree->diagnostics().empty() == false) {
+        auto diags = newTree->diagnostics();
+        if (checkDiagsError(diags)) {
+            result.error       = RebuildError::Syntax;
+            result.diagnostics = DiagnosticEngine::reportAll(sourceManager, diags);
+        }
+    } else if (options.validation == ValidationLevel::Full) {
+        // Only elaborate the hierarchies containing the touched definitions when they are known, otherwise the whole
+        // design. Going through their instantiating parents also checks that every instantiation still fits.
+        CompilationOptions compilationOptions;
+        for (auto name : validationTops(*newTree, touched, options.touchedDefinitions)) {
+            compilationOptions.topModules.emplace(name);
+        }
+
+        Bag bag;
+        bag.set(compilationOptions);
+        Compilation compilation(bag);
+        recordPhase(result.stats, options.detailedStats, "addSyntaxTree", [&] { compilation.addSyntaxTree(newTree); });
+        auto diags = recordPhase(result.stats, options.detailedStats, "getAllDiagnostics", [&] { return compilation.getAllDiagnostics(); });
+        if (diags.empty() == false) {
+            if (checkDiagsError(diags)) {
+                result.error       = RebuildError::Compilation;
+                result.diagnostics = DiagnosticEngine::reportAll(sourceManager, diags);
+            }
+        }
+    }
+
+    result.stats.validationTime = std::chrono::steady_clock::now() - start;
+}
+
+static void reportRebuildError(const RebuildResult &result, const SyntaxTree &oldTree, const RebuildOptions &options) {
+    if (result.error == RebuildError::Syntax) {
+        fmt::println("[rebuildSyntaxTree] SyntaxError: {}", result.diagnostics);
+        fflush(stdout);
+
+        if (options.printTree) {
+            fmt::println("[rebuildSyntaxTree] SyntaxError tree => {}", SyntaxPrinter::printFile(oldTree));
+            fflush(stdout);
+        }
+
+        // Syntax error
+        assert(false && "[rebuildSyntaxTree] Syntax error");
+    } else if (result.error == RebuildError::Compilation) {
+        fmt::println("[rebuildSyntaxTree] CompilationError: {}", result.diagnostics);
+        fflush(stdout);
+
+        if (options.printTree) {
+            fmt::println("[rebuildSyntaxTree] CompilationError tree => {}", SyntaxPrinter::printFile(oldTree));
+            fflush(stdout);
+        }
+
+        // Compilation error
+        assert(false && "[rebuildSyntaxTree] Compilation error");
+    }
+}
+
+// Owns the scoped SourceManager of a rebuilt tree. The tree is handed out through an aliasing shared_ptr, so both are
+// released together once the last reference is gone.
+struct SyntaxTreeHolder {
+    std::unique_ptr<SourceManager> sourceManager;
+    std::shared_ptr<SyntaxTree> tree;
+};
+
+static SourceManager *rebuildSourceManager(const RebuildOptions &options) {
+    if (options.sourceManager != nullptr) {
+        return options.sourceManager;
+    }
+    return options.scopedSourceManager ? nullptr : &SyntaxTree::getDefaultSourceManager();
+}
+
+static std::shared_ptr<SyntaxTree> parseText(std::string_view text, const Bag &parseOptions, const RebuildOptions &options) {
+    if (auto sourceManager = rebuildSourceManager(options)) {
+        return SyntaxTree::fromFileInMemory(text, *sourceManager, "source", "", parseOptions);
+    }
+
+    auto holder           = std::make_shared<SyntaxTreeHolder>();
+    holder->sourceManager = std::make_unique<SourceManager>();
+    holder->tree          = SyntaxTree::fromFileInMemory(text, *holder->sourceManager, "source", "", parseOptions);
+    return std::shared_ptr<SyntaxTree>(holder, holder->tree.get());
+}
+
+// Tells whether a subtree can be deep-cloned into a tree of its own. Tokens the parser had to make up (or a rewriter
+// left without kind) only come out right after going through the lexer again. Cloned tokens and trivia keep viewing
+// the text they came from, so all of it has to live in a buffer of the SourceManager, which outlives the trees; text
+// a rewriter allocated in the old tree would tie the clone to that tree.
+class CloneChecker : public SyntaxVisitor<CloneChecker> {
+  public:
+    bool needsReparse = false;
+
+    explicit CloneChecker(const SourceManager &sourceManager) : sourceManager(sourceManager) {}
+
+    void visitToken(Token token) {
+        if (needsReparse) {
+            return;
+        }
+        if (token.isMissing() || token.kind == TokenKind::Unknown) {
+            needsReparse = true;
+            return;
+        }
+
+        auto loc = sourceManager.getFullyOriginalLoc(token.location());
+        if (!loc.buffer().valid()) {
+            needsReparse = true;
+            return;
+        }
+
+        auto buffer = sourceManager.getSourceText(loc.buffer());
+        if (!inBuffer(buffer, token.rawText())) {
+            needsReparse = true;
+            return;
+        }
+        for (auto &trivia : token.trivia()) {
+            if (trivia.syntax() == nullptr && !inBuffer(buffer, trivia.getRawText())) {
+                needsReparse = true;
+                return;
+            }
+        }
+    }
+
+  private:
+    static bool inBuffer(std::string_view buffer, std::string_view text) { return text.empty() || (text.data() >= buffer.data() && text.data() + text.size() <= buffer.data() + buffer.size()); }
+
+    const SourceManager &sourceManager;
+};
+
+static bool isListKind(SyntaxKind kind) { return kind == SyntaxKind::SyntaxList || kind == SyntaxKind::SeparatedList || kind == SyntaxKind::TokenList; }
+
+// Sets parent pointers below node the way slang's syntax constructors do: a list and its elements both point at the
+// node owning the list, never an element at the list.
+static void fixParents(SyntaxNode &node) {
+    for (size_t i = 0; i < node.getChildCount(); i++) {
+        auto child = node.childNode(i);
+        if (child == nullptr) {
+            continue;
+        }
+
+        child->parent = &node;
+        if (!isListKind(child->kind)) {
+            fixParents(*child);
+            continue;
+        }
+        for (size_t j = 0; j < child->getChildCount(); j++) {
+            if (auto element = child->childNode(j)) {
+                element->parent = &node;
+                fixParents(*element);
+            }
+        }
+    }
+}
+
+#ifndef NDEBUG
+// Whether every node below a points at the same relative parent (its own parent node or, for list elements, the
+// list's owner) as the corresponding node below b.
+static bool sameParents(const SyntaxNode &a, const SyntaxNode &b) {
+    if (a.getChildCount() != b.getChildCount()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.getChildCount(); i++) {
+        auto childA = a.childNode(i);
+        auto childB = b.childNode(i);
+        if (childA == nullptr || childB == nullptr) {
+            if (childA != childB) {
+                return false;
+            }
+            continue;
+        }
+        if ((childA->parent == &a) != (childB->parent == &b) || (childA->parent == a.parent) != (childB->parent == b.parent)) {
+            return false;
+        }
+        if (!sameParents(*childA, *childB)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Debug check that a tree assembled from cloned nodes has the parents a parse of its text would give it.
+static void checkParsedParents(const SyntaxTree &tree) {
+    auto text = SyntaxPrinter::printFile(tree);
+    SourceManager sourceManager;
+    auto parsed = SyntaxTree::fromText(text, sourceManager, "source", "", tree.options());
+    if (parsed->diagnostics().empty()) {
+        assert(sameParents(tree.root(), parsed->root()) && "[rebuildSyntaxTree] cloned parents differ from a parsed tree");
+    }
+}
+#endif
+
+// Deleter of cloned trees, remembering the tree the clone chain started from.
+struct CloneDeleter {
+    std::shared_ptr<SyntaxTree> origin;
+
+    void operator()(SyntaxTree *tree) const { delete tree; }
+};
+
+// Returns nullptr if the tree cannot be cloned and has to go through the text path.
+static std::shared_ptr<SyntaxTree> cloneTree(const std::shared_ptr<SyntaxTree> &oldTree) {
+    CloneChecker checker(oldTree->sourceManager());
+    oldTree->root().visit(checker);
+    if (checker.needsReparse) {
+        return nullptr;
+    }
+
+    BumpAllocator alloc;
+    auto root    = deepClone(oldTree->root(), alloc);
+    root->parent = nullptr;
+    fixParents(*root);
+
+    // The clone's text lives in SourceManager buffers, so it needs nothing of the old tree but its parse options and
+    // library, which it gets by naming a parent tree. That parent is the tree the clone chain started from rather than
+    // oldTree, so repeated clone rebuilds keep one tree alive instead of every generation.
+    auto origin = oldTree;
+    if (auto deleter = std::get_deleter<CloneDeleter>(oldTree)) {
+        origin = deleter->origin;
+    }
+    auto tree = new SyntaxTree(root, oldTree->getSourceLibrary(), oldTree->sourceManager(), std::move(alloc), origin);
+#ifndef NDEBUG
+    checkParsedParents(*tree);
+#endif
+    return std::shared_ptr<SyntaxTree>(tree, CloneDeleter{origin});
+}
+
+// `sharedOld` is only needed (and may be null otherwise) for RebuildMode::Clone.
+static RebuildResult rebuildOne(const SyntaxTree &oldTree, const std::shared_ptr<SyntaxTree> &sharedOld, const RebuildOptions &options) {
+    RebuildResult result;
+    auto &stats   = result.stats;
+    auto detailed = options.detailedStats;
+    // A clone stays in the SourceManager of the old tree, so it cannot honor a request for any other one.
+    auto sameSourceManager = options.sourceManager != nullptr ? options.sourceManager == &oldTree.sourceManager() : !options.scopedSourceManager;
+    if (options.mode == RebuildMode::Clone && sharedOld != nullptr && sameSourceManager) {
+        result.tree = recordPhase(stats, detailed, "deepClone", [&] { return cloneTree(sharedOld); });
+        if (result.tree != nullptr) {
+            validateRebuiltTree(result.tree, options, {}, result);
+            return result;
+        }
+    }
+
+    auto text                 = recordPhase(stats, detailed, "printFile", [&] { return SyntaxPrinter::printFile(oldTree); });
+    stats.phases.back().bytes = text.size();
+
+    if (options.cache != nullptr) {
+        if (options.cache->find(text, oldTree.options(), rebuildSourceManager(options), options, result)) {
+            return result;
+        }
+    }
+
+    result.tree               = recordPhase(stats, detailed, "fromFileInMemory", [&] { return parseText(text, oldTree.options(), options); });
+    stats.phases.back().bytes = text.size();
+    if (detailed) {
+        TokenCounter counter;
+        result.tree->root().visit(counter);
+        stats.phases.back().tokens = counter.count;
+    }
+
+    validateRebuiltTree(result.tree, options, {}, result);
+
+    if (options.cache != nullptr) {
+        options.cache->insert(std::move(text), oldTree.options(), rebuildSourceManager(options), options, result);
+    }
+    return result;
+}
+
+std::shared_ptr<SyntaxTree> rebuildSyntaxTree(const SyntaxTree &oldTree, const RebuildOptions &options, RebuildStats *stats) {
+    auto result = rebuildOne(oldTree, nullptr, options);
+    if (stats != nullptr) {
+        *stats = result.stats;
+    }
+    reportRebuildError(result, oldTree, options);
+    return result.tree;
+}
+
+std::shared_ptr<SyntaxTree> rebuildSyntaxTree(const SyntaxTree &oldTree, bool printTree) { return rebuildSyntaxTree(oldTree, RebuildOptions{.printTree = printTree}); }
+
+std::shared_ptr<SyntaxTree> rebuildSyntaxTree(std::shared_ptr<SyntaxTree> oldTree, const RebuildOptions &options, RebuildStats *stats) {
+    auto result = rebuildOne(*oldTree, oldTree, options);
+    if (stats != nullptr) {
+        *stats = result.stats;
+    }
+    reportRebuildError(result, *oldTree, options);
+    return result.tree;
+}
+
+
+static std::string printMember(const SyntaxNode &node) { return SyntaxPrinter().setIncludeDirectives(true).print(node).str(); }
+
+static bool sameSyntax(const SyntaxNode &a, const SyntaxNode &b);
+
+static bool sameToken(Token a, Token b) {
+    if (!a || !b) {
+        return !a && !b;
+    }
+    if (a.kind != b.kind || a.rawText() != b.rawText() || a.trivia().size() != b.trivia().size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.trivia().size(); i++) {
+        auto &ta = a.trivia()[i];
+        auto &tb = b.trivia()[i];
+        if (ta.kind != tb.kind || ta.getRawText() != tb.getRawText()) {
+            return false;
+        }
+        if ((ta.syntax() == nullptr) != (tb.syntax() == nullptr) || (ta.syntax() != nullptr && !sameSyntax(*ta.syntax(), *tb.syntax()))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether two subtrees print to the same text, without printing them: shared nodes are equal right away and the first
+// differing token ends the walk.
+static bool sameSyntax(const SyntaxNode &a, const SyntaxNode &b) {
+    if (&a == &b) {
+        return true;
+    }
+    if (a.kind != b.kind || a.getChildCount() != b.getChildCount()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.getChildCount(); i++) {
+        auto childA = a.childNode(i);
+        auto childB = b.childNode(i);
+        if (childA != nullptr || childB != nullptr) {
+            if (childA == nullptr || childB == nullptr || !sameSyntax(*childA, *childB)) {
+                return false;
+            }
+        } else if (!sameToken(a.childToken(i), b.childToken(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+class DirectiveFinder : public SyntaxVisitor<DirectiveFinder> {
+  public:
+    bool found = false;
+
+    void visitToken(Token token) {
+        for (auto &trivia : token.trivia()) {
+            found |= trivia.kind == TriviaKind::Directive;
+        }
+    }
+};
+
+// Returns nullptr if the touched members cannot be reparsed on their own and the whole tree has to go through the text path.
+static std::shared_ptr<SyntaxTree> spliceTree(const std::shared_ptr<SyntaxTree> &baseTree, const SyntaxTree &newTree, std::vector<std::string_view> &touched) {
+    if (baseTree->root().kind != SyntaxKind::CompilationUnit || newTree.root().kind != SyntaxKind::CompilationUnit) {
+        return nullptr;
+    }
+
+    auto &baseUnit = baseTree->root().as<CompilationUnitSyntax>();
+    auto &newUnit  = newTree.root().as<CompilationUnitSyntax>();
+
+    flat_hash_map<std::string_view, MemberSyntax *> baseModules;
+    for (auto member : baseUnit.members) {
+        if (isModuleLike(member->kind)) {
+            baseModules.emplace(member->as<ModuleDeclarationSyntax>().header->name.rawText(), member);
+        }
+    }
+
+    // A module is untouched if the rewriter left the very same node in place or if it still prints to the same text.
+    // Everything else (touched modules and all non-module members) is printed into one buffer and reparsed together,
+    // nullptr marks the slots that are filled from that reparse.
+    std::vector<MemberSyntax *> members;
+    std::string changedText;
+    size_t changedCount = 0;
+    for (auto member : newUnit.members) {
+        MemberSyntax *reused = nullptr;
+        if (isModuleLike(member->kind)) {
+            auto it = baseModules.find(member->as<ModuleDeclarationSyntax>().header->name.rawText());
+            if (it != baseModules.end() && sameSyntax(*it->second, *member)) {
+                reused = it->second;
+            }
+        }
+
+        if (reused == nullptr) {
+            // A touched package is still reparsed, but only definitions can be named as top modules for validation;
+            // getAllDiagnostics checks the packages of the tree either way.
+            if (isDefinitionKind(member->kind)) {
+                touched.push_back(member->as<ModuleDeclarationSyntax>().header->name.rawText());
+            }
+            changedText += printMember(*member);
+            changedCount++;
+        } else {
+            // Reused modules are cloned below, which needs their text to outlive the base tree.
+            CloneChecker checker(baseTree->sourceManager());
+            reused->visit(checker);
+            if (checker.needsReparse) {
+                return nullptr;
+            }
+        }
+        members.push_back(reused);
+    }
+    changedText += SyntaxPrinter().setIncludeDirectives(true).print(newUnit.endOfFile).str();
+
+    // Directives in a reused module (`default_nettype, `timescale, `begin_keywords, `define, ...) set up state for the
+    // members after it that the reparse would not see, often without any error to fall back on.
+    auto lastTouched = std::find(members.rbegin(), members.rend(), nullptr);
+    for (auto it = members.begin(); lastTouched != members.rend() && it != lastTouched.base(); ++it) {
+        if (*it != nullptr) {
+            DirectiveFinder finder;
+            (*it)->visit(finder);
+            if (finder.found) {
+                return nullptr;
+            }
+        }
+    }
+
+    // Touched modules that depend on preprocessor state from elsewhere in the file cannot be parsed on their own,
+    // fall back to the full rebuild whenever the partial reparse does not line up.
+    auto partTree  = SyntaxTree::fromFileInMemory(changedText, baseTree->sourceManager(), "source", "", newTree.options(), newTree.getSourceLibrary());
+    auto partDiags = partTree->diagnostics();
+    auto &partUnit = partTree->root().as<CompilationUnitSyntax>();
+    if (checkDiagsError(partDiags) || partUnit.members.size() != changedCount) {
+        return nullptr;
+    }
+
+    // Reused modules are cloned into the new tree rather than moved over, so the base tree is left as it is (still
+    // usable by Compilations and SemanticModels holding it) and is not kept alive by the result. The reparsed members
+    // stay in partTree, which becomes the parent of the new tree: it is private to this rebuild and carries the parse
+    // options and library of newTree. Each rebuilt tree therefore keeps only its own part alive.
+    BumpAllocator alloc;
+    SmallVector<MemberSyntax *> spliced;
+    size_t next = 0;
+    for (auto member : members) {
+        if (member != nullptr) {
+            auto clone = deepClone(*member, alloc);
+            fixParents(*clone);
+            spliced.push_back(clone);
+        } else {
+            spliced.push_back(partUnit.members[next++]);
+        }
+    }
+
+    // The CompilationUnitSyntax constructor re-parents every spliced member onto the new root.
+    auto root = alloc.emplace<CompilationUnitSyntax>(spliced.copy(alloc), partUnit.endOfFile);
+    auto tree = std::make_shared<SyntaxTree>(root, newTree.getSourceLibrary(), baseTree->sourceManager(), std::move(alloc), partTree);
+#ifndef NDEBUG
+    checkParsedParents(*tree);
+#endif
+    return tree;
+}
+
+std::shared_ptr<SyntaxTree> rebuildSyntaxTreeIncremental(std::shared_ptr<SyntaxTree> baseTree, const SyntaxTree &newTree, const RebuildOptions &options, RebuildStats *stats) {
+    std::vector<std::string_view> touched;
+    RebuildResult result;
+    result.tree = recordPhase(result.stats, options.detailedStats, "splice", [&] { return spliceTree(baseTree, newTree, touched); });
+    if (result.tree == nullptr) {
+        return rebuildSyntaxTree(newTree, options, stats);
+    }
+
+    validateRebuiltTree(result.tree, options, touched, result);
+    if (stats != nullptr) {
+        *stats = result.stats;
+    }
+    reportRebuildError(result, newTree, options);
+    return result.tree;
+}
+
+std::shared_ptr<SyntaxTree> rebuildSyntaxTreeIncremental(std::shared_ptr<SyntaxTree> baseTree, const SyntaxTree &newTree, bool printTree) { return rebuildSyntaxTreeIncremental(baseTree, newTree, RebuildOptions{.printTree = printTree}); }
+
+void parallelFor(size_t count, unsigned threads, const std::function<void(size_t)> &func) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            func(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            for (size_t i = next++; i < count; i = next++) {
+                func(i);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+std::vector<RebuildResult> rebuildSyntaxTrees(std::span<const std::shared_ptr<SyntaxTree>> trees, const RebuildOptions &options, unsigned threads) {
+    std::vector<RebuildResult> results(trees.size());
+    parallelFor(trees.size(), threads, [&](size_t i) { results[i] = rebuildOne(*trees[i], trees[i], options); });
+    return results;
+}
+
+static void hashCombine(size_t &seed, size_t value) { seed ^= value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2); }
+
+RebuildCache::Settings::Settings(const Bag &parseOptions, const SourceManager *sourceManager, const RebuildOptions &options)
+    : preprocessor(parseOptions.getOrDefault<PreprocessorOptions>()), lexer(parseOptions.getOrDefault<LexerOptions>()), parser(parseOptions.getOrDefault<ParserOptions>()), sourceManager(sourceManager), validation(options.validation),
+      touchedDefinitions(options.touchedDefinitions) {
+    std::sort(touchedDefinitions.begin(), touchedDefinitions.end());
+}
+
+// Compares every field of the parse options; a field added to them in slang has to be added here and in hash().
+bool RebuildCache::Settings::operator==(const Settings &other) const {
+    auto &pp      = preprocessor;
+    auto &otherPP = other.preprocessor;
+    return pp.maxIncludeDepth == otherPP.maxIncludeDepth && pp.predefineSource == otherPP.predefineSource && pp.languageVersion == otherPP.languageVersion && pp.predefines == otherPP.predefines && pp.undefines == otherPP.undefines &&
+           pp.additionalIncludePaths == otherPP.additionalIncludePaths && pp.ignoreDirectives == otherPP.ignoreDirectives && lexer.maxErrors == other.lexer.maxErrors && lexer.languageVersion == other.lexer.languageVersion &&
+           lexer.enableLegacyProtect == other.lexer.enableLegacyProtect && parser.maxRecursionDepth == other.parser.maxRecursionDepth && parser.languageVersion == other.parser.languageVersion && sourceManager == other.sourceManager &&
+           validation == other.validation && touchedDefinitions == other.touchedDefinitions;
+}
+
+size_t RebuildCache::Settings::hash() const {
+    size_t seed = 0;
+    for (auto &define : preprocessor.predefines) {
+        hashCombine(seed, std::hash<std::string>{}(define));
+    }
+    for (auto &undefine : preprocessor.undefines) {
+        hashCombine(seed, std::hash<std::string>{}(undefine));
+    }
+    for (auto &path : preprocessor.additionalIncludePaths) {
+        hashCombine(seed, std::hash<std::string>{}(path.string()));
+    }
+    // The set's iteration order is unspecified, its size is enough to pick a candidate.
+    hashCombine(seed, preprocessor.ignoreDirectives.size());
+    hashCombine(seed, std::hash<std::string>{}(preprocessor.predefineSource));
+    hashCombine(seed, preprocessor.maxIncludeDepth);
+    hashCombine(seed, static_cast<size_t>(preprocessor.languageVersion));
+    hashCombine(seed, lexer.maxErrors);
+    hashCombine(seed, static_cast<size_t>(lexer.languageVersion));
+    hashCombine(seed, lexer.enableLegacyProtect);
+    hashCombine(seed, parser.maxRecursionDepth);
+    hashCombine(seed, static_cast<size_t>(parser.languageVersion));
+    hashCombine(seed, std::hash<const void *>{}(sourceManager));
+    hashCombine(seed, static_cast<size_t>(validation));
+    for (auto &name : touchedDefinitions) {
+        hashCombine(seed, std::hash<std::string>{}(name));
+    }
+    return seed;
+}
+
+bool RebuildCache::find(std::string_view text, const Bag &parseOptions, const SourceManager *sourceManager, const RebuildOptions &options, RebuildResult &result) {
+    Settings settings(parseOptions, sourceManager, options);
+    auto key = std::hash<std::string_view>{}(text);
+    hashCombine(key, settings.hash());
+
+    std::lock_guard lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end() || it->second->text != text || !(it->second->settings == settings)) {
+        misses++;
+        return false;
+    }
+
+    // Move the entry to the front of the LRU list.
+    entries.splice(entries.begin(), entries, it->second);
+    hits++;
+
+    result.tree           = it->second->result.tree;
+    result.error          = it->second->result.error;
+    result.diagnostics    = it->second->result.diagnostics;
+    result.stats.cacheHit = true;
+    return true;
+}
+
+void RebuildCache::insert(std::string text, const Bag &parseOptions, const SourceManager *sourceManager, const RebuildOptions &options, const RebuildResult &result) {
+    Settings settings(parseOptions, sourceManager, options);
+    auto key = std::hash<std::string_view>{}(text);
+    hashCombine(key, settings.hash());
+
+    std::lock_guard lock(mutex);
+    if (auto it = index.find(key); it != index.end()) {
+        bytes -= it->second->text.size();
+        entries.erase(it->second);
+        index.erase(it);
+    }
+
+    bytes += text.size();
+    entries.push_front(Entry{key, std::move(text), std::move(settings), result});
+    index[key] = entries.begin();
+
+    // Evict least recently used entries, but always keep the one just inserted.
+    while (entries.size() > 1 && (entries.size() > maxEntries || bytes > maxBytes)) {
+        auto &last = entries.back();
+        bytes -= last.text.size();
+        index.erase(last.key);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+void RebuildCache::clear() {
+    std::lock_guard lock(mutex);
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+size_t RebuildCache::size() const {
+    std::lock_guard lock(mutex);
+    return entries.size();
+}
+
+void FdSink::write(std::string_view text) {
+    buffer.append(text);
+    if (buffer.size() >= batchSize) {
+        flush();
+    }
+}
+
+void FdSink::flush() {
+    size_t done = 0;
+    while (done < buffer.size()) {
+        auto n = ::write(fd, buffer.data() + done, buffer.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    buffer.clear();
+}
+
+// Name of T as spelled by the compiler (e.g. "slang::syntax::ModuleDeclarationSyntax"), cut out of the signature of this
+// function at compile time. The listers dispatch on the static type of every node, so this gives them the node type name
+// for free instead of demangling it at runtime for each node.
+template <typename T> constexpr std::string_view typeName() {
+#if defined(__clang__) || defined(__GNUC__)
+    std::string_view signature = __PRETTY_FUNCTION__;
+    auto start                 = signature.find("T = ") + 4;
+    auto end                   = signature.find_first_of(";]", start);
+    return signature.substr(start, end - start);
+#else
+    std::string_view signature = __FUNCSIG__;
+    auto start                 = signature.find("typeName<") + 9;
+    auto end                   = signature.rfind(">(void)");
+    auto name                  = signature.substr(start, end - start);
+    for (std::string_view keyword : {"class ", "struct ", "enum "}) {
+        if (name.starts_with(keyword)) {
+            return name.substr(keyword.size());
+        }
+    }
+    return name;
+#endif
+}
+
+template <typename T> inline constexpr std::string_view typeNameOf = typeName<std::remove_cvref_t<T>>();
+
+// Tree-art indentation of the node being listed. It is kept up to date as the listers descend and ascend, so
+// printing a node costs no allocation instead of rebuilding the whole string from the stack of levels.
+class TreePrefix {
+  public:
+    void push(bool lastChild) {
+        marks.push_back(indent.size());
+        if (!lastChildStack.empty()) {
+            indent += lastChildStack.back() ? "    " : "│   ";
+        }
+        lastChildStack.push_back(lastChild);
+    }
+
+    void pop() {
+        lastChildStack.pop_back();
+        indent.resize(marks.back());
+        marks.pop_back();
+    }
+
+    // Indentation of all enclosing levels but the innermost one, which is drawn by branch().
+    std::string_view indentation() const { return indent; }
+
+    std::string_view branch() const {
+        if (lastChildStack.empty()) {
+            return "";
+        }
+        return lastChildStack.back() ? "└─ " : "├─ ";
+    }
+
+  private:
+    std::string indent;
+    std::vector<size_t> marks;
+    std::vector<bool> lastChildStack;
+};
+
+// Formats the lines of a lister into a local buffer and hands them to the sink in large chunks,
+// so a sink sees a few big writes instead of one per node.
+class ListerOutput {
+  public:
+    explicit ListerOutput(ListerSink &sink) : sink(sink) {}
+
+    ~ListerOutput() { finish(); }
+
+    template <typename... Args> void println(fmt::format_string<Args...> format, Args &&...args) {
+        fmt::format_to(std::back_inserter(buffer), format, std::forward<Args>(args)...);
+        buffer.push_back('\n');
+        if (buffer.size() >= chunkSize) {
+            flushBuffer();
+        }
+    }
+
+    void finish() {
+        flushBuffer();
+        sink.flush();
+    }
+
+    // For records that are not formatted lines: append to raw() and call commit() once the record is complete.
+    fmt::memory_buffer &raw() { return buffer; }
+
+    void commit() {
+        if (buffer.size() >= chunkSize) {
+            flushBuffer();
+        }
+    }
+
+  private:
+    void flushBuffer() {
+        if (buffer.size() != 0) {
+            sink.write(std::string_view(buffer.data(), buffer.size()));
+            buffer.clear();
         }
     }
-    return false;
+
+    static constexpr size_t chunkSize = 64 * 1024;
+
+    ListerSink &sink;
+    fmt::memory_buffer buffer;
+};
+
+// One listed node, as written by the structured (NDJSON / binary) listing formats.
+struct ListRecord {
+    uint64_t id;
+    uint64_t parent; // noParent for the node a listing starts at
+    uint16_t kindId;
+    std::string_view kind;
+    std::string_view type;
+    ListRecordCategory category;
+    uint64_t depth;
+    std::string_view name;
+    SourceRange range;
+    uint64_t width;
+};
+
+static constexpr uint64_t noParent = UINT64_MAX;
+
+static void appendText(fmt::memory_buffer &buffer, std::string_view text) { buffer.append(text.data(), text.data() + text.size()); }
+
+static void appendJsonString(fmt::memory_buffer &buffer, std::string_view text) {
+    buffer.push_back('"');
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            buffer.push_back('\\');
+            buffer.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            fmt::format_to(std::back_inserter(buffer), "\\u{:04x}", static_cast<unsigned>(c));
+        } else {
+            buffer.push_back(c);
+        }
+    }
+    buffer.push_back('"');
 }
 
-std::shared_ptr<SyntaxTree> rebuildSyntaxTree(const SyntaxTree &oldTree, bool printTree) {
-    auto newTree = SyntaxTree::fromFileInMemory(SyntaxPrinter::printFile(oldTree), SyntaxTree::getDefaultSourceManager());
-    if (newTree->diagnostics().empty() == false) {
-        auto diags = newTree->diagnostics();
-        if (checkDiagsError(diags)) {
-            auto ret = DiagnosticEngine::reportAll(SyntaxTree::getDefaultSourceManager(), diags);
-            fmt::println("[rebuildSyntaxTree] SyntaxError: {}", ret);
-            fflush(stdout);
+static void appendLittleEndian(fmt::memory_buffer &buffer, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
 
-            if (printTree) {
-                fmt::println("[rebuildSyntaxTree] SyntaxError tree => {}", SyntaxPrinter::printFile(oldTree));
-                fflush(stdout);
-            }
-            
-            // Syntax error
-            assert(false && "[rebuildSyntaxTree] Syntax error");
+static void writeListHeader(ListerOutput &out, ListFormat format, bool ast) {
+    if (format == ListFormat::Binary) {
+        auto &buffer = out.raw();
+        appendText(buffer, "SLCD");
+        buffer.push_back(static_cast<char>(1));
+        buffer.push_back(static_cast<char>(ast ? 1 : 0));
+        out.commit();
+    }
+}
+
+static void writeListRecord(ListerOutput &out, ListFormat format, const ListRecord &record) {
+    auto &buffer = out.raw();
+    auto start   = record.range.start();
+    auto end     = record.range.end();
+
+    if (format == ListFormat::NDJson) {
+        fmt::format_to(std::back_inserter(buffer), "{{\"id\":{},\"parent\":", record.id);
+        if (record.parent == noParent) {
+            appendText(buffer, "null");
+        } else {
+            fmt::format_to(std::back_inserter(buffer), "{}", record.parent);
         }
+        fmt::format_to(std::back_inserter(buffer), ",\"kind\":\"{}\",\"kindId\":{},\"category\":{},\"type\":\"{}\",\"depth\":{},\"name\":", record.kind, record.kindId, static_cast<unsigned>(record.category), record.type, record.depth);
+        appendJsonString(buffer, record.name);
+        fmt::format_to(std::back_inserter(buffer), ",\"range\":[{},{},{}],\"width\":{}}}\n", start.buffer().getId(), start.offset(), end.offset(), record.width);
     } else {
-        Compilation compilation;
-        compilation.addSyntaxTree(newTree);
-        auto diags = compilation.getAllDiagnostics();
-        if (diags.empty() == false) {
-            if (checkDiagsError(diags)) {
-                auto ret = DiagnosticEngine::reportAll(SyntaxTree::getDefaultSourceManager(), diags);
-                fmt::println("[rebuildSyntaxTree] CompilationError: {}", ret);
-                fflush(stdout);
+        appendLittleEndian(buffer, record.id, 8);
+        appendLittleEndian(buffer, record.parent, 8);
+        appendLittleEndian(buffer, record.kindId, 2);
+        appendLittleEndian(buffer, static_cast<uint8_t>(record.category), 1);
+        appendLittleEndian(buffer, 0, 1);
+        appendLittleEndian(buffer, record.depth, 4);
+        appendLittleEndian(buffer, start.buffer().getId(), 4);
+        appendLittleEndian(buffer, start.offset(), 4);
+        appendLittleEndian(buffer, end.offset(), 4);
+        appendLittleEndian(buffer, record.width, 8);
+        appendLittleEndian(buffer, record.name.size(), 4);
+        appendText(buffer, record.name);
+    }
+    out.commit();
+}
 
-                if (printTree) {
-                    fmt::println("[rebuildSyntaxTree] CompilationError tree => {}", SyntaxPrinter::printFile(oldTree));
-                    fflush(stdout);
-                }
+bool globMatch(std::string_view pattern, std::string_view text) {
+    // Greedy matching that backtracks to the most recent '*' only, which is enough since a later '*' can absorb
+    // whatever an earlier one would have.
+    size_t p = 0, t = 0;
+    size_t starP = std::string_view::npos, starT = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+            p++;
+            t++;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            starP = p++;
+            starT = t;
+        } else if (starP != std::string_view::npos) {
+            p = starP + 1;
+            t = ++starT;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
 
-                // Compilation error
-                assert(false && "[rebuildSyntaxTree] Compilation error");
-            }
+// A ListFilter prepared for the listers: kind sets as bitmaps, the regex compiled once, and which subtrees cannot
+// contain a match.
+class ListMatcher {
+  public:
+    explicit ListMatcher(const ListFilter &filter) : glob(filter.nameGlob) {
+        for (auto kind : filter.syntaxKinds) {
+            addKind(syntaxKinds, static_cast<size_t>(kind));
+        }
+        for (auto kind : filter.symbolKinds) {
+            addKind(symbolKinds, static_cast<size_t>(kind));
+        }
+        if (!filter.nameRegex.empty()) {
+            regex.emplace(filter.nameRegex, std::regex::ECMAScript | std::regex::optimize);
+        }
+
+        bool namePattern = !glob.empty() || regex.has_value();
+        restrictsAST     = !symbolKinds.empty() || namePattern;
+
+        // Expressions never contain members, so a filter that only asks for members need not look inside them.
+        membersOnly = !filter.syntaxKinds.empty() && std::all_of(filter.syntaxKinds.begin(), filter.syntaxKinds.end(), [](SyntaxKind kind) { return MemberSyntax::isKind(kind); });
+    }
+
+    // Whether the subtree at node can be skipped without missing a match.
+    template <typename T> bool prunes(const T &node) const {
+        if constexpr (std::is_base_of_v<ExpressionSyntax, T>) {
+            return membersOnly;
+        } else if constexpr (std::is_base_of_v<SyntaxNode, T> || std::is_base_of_v<Symbol, T>) {
+            return false;
+        } else {
+            // Statements, expressions and the other non-symbol AST nodes declare no symbols and never match a
+            // restricting filter.
+            return restrictsAST;
+        }
+    }
+
+    bool matchesSyntax(SyntaxKind kind, std::string_view name) const { return hasKind(syntaxKinds, static_cast<size_t>(kind)) && matchesName(name); }
+
+    template <typename T> bool matchesAST(const T &ast) const {
+        if constexpr (std::is_base_of_v<Symbol, T>) {
+            return hasKind(symbolKinds, static_cast<size_t>(ast.kind)) && matchesName(ast.name);
+        } else {
+            return !restrictsAST;
+        }
+    }
+
+  private:
+    static void addKind(std::vector<bool> &kinds, size_t kind) {
+        if (kinds.size() <= kind) {
+            kinds.resize(kind + 1);
+        }
+        kinds[kind] = true;
+    }
+
+    static bool hasKind(const std::vector<bool> &kinds, size_t kind) { return kinds.empty() || (kind < kinds.size() && kinds[kind]); }
+
+    bool matchesName(std::string_view name) const {
+        if (!glob.empty() && !globMatch(glob, name)) {
+            return false;
         }
+        return !regex.has_value() || std::regex_match(name.begin(), name.end(), *regex);
     }
 
-    return newTree;
+    std::vector<bool> syntaxKinds;
+    std::vector<bool> symbolKinds;
+    std::string glob;
+    std::optional<std::regex> regex;
+    bool restrictsAST = false;
+    bool membersOnly  = false;
+};
+
+// The name a ListFilter matches a syntax node by.
+template <typename T> std::string_view syntaxNodeName(const T &syn) {
+    if constexpr (std::is_base_of_v<ModuleDeclarationSyntax, T>) {
+        return syn.header->name.rawText();
+    } else if constexpr (std::is_same_v<T, DeclaratorSyntax>) {
+        return syn.name.rawText();
+    } else if constexpr (std::is_same_v<T, IdentifierNameSyntax> || std::is_same_v<T, IdentifierSelectNameSyntax>) {
+        return syn.identifier.rawText();
+    } else {
+        return {};
+    }
 }
 
-class SynaxLister : public SyntaxVisitor<SynaxLister> {
+class SynaxLister : public SyntaxContextVisitor<SynaxLister> {
   public:
     const uint64_t maxDepth;
     uint64_t depth = 0;
     uint64_t count = 0;
-    std::vector<bool> lastChildStack;
+    TreePrefix prefix;
+    std::string extra;
+    std::string_view nodeName;
+    std::vector<uint64_t> parentIds;
+    const ListFormat format;
+    const ListMatcher filter;
+    ListerOutput out;
+
+    SynaxLister(ListerSink &sink, uint64_t maxDepth = 10000, ListFormat format = ListFormat::Text, const ListFilter &filter = {}) : maxDepth(maxDepth), format(format), filter(filter), out(sink) {}
+
+    // Descends into a node the filter does not print. Its children keep their real depth.
+    template <typename T> void visitUnlisted(const T &syn) {
+        depth++;
+        visitDefault(syn);
+        depth--;
+    }
+
+    template <typename T> void emit(const T &syn) {
+        if (format == ListFormat::Text) {
+            out.println("{}{}[{}] depth: {}\tsynKind: {}\t{}", prefix.indentation(), prefix.branch(), count, depth, toString(syn.kind), extra);
+            return;
+        }
 
-    SynaxLister(uint64_t maxDepth = 10000) : maxDepth(maxDepth) {}
+        auto parent = parentIds.empty() ? noParent : parentIds.back();
+        writeListRecord(out, format, ListRecord{count, parent, static_cast<uint16_t>(syn.kind), toString(syn.kind), typeNameOf<T>, ListRecordCategory::Syntax, depth, nodeName, syn.sourceRange(), 0});
+    }
 
 #define SYNTAX_NAME()                                                                                                                                                                                                                                                                                                                                                                                          \
     extra += "\tsynName: ";                                                                                                                                                                                                                                                                                                                                                                                    \
-    auto name = boost::typeindex::type_id<decltype(syn)>().pretty_name();                                                                                                                                                                                                                                                                                                                                      \
-    extra += std::string(name);                                                                                                                                                                                                                                                                                                                                                                                \
+    extra += typeNameOf<decltype(syn)>;                                                                                                                                                                                                                                                                                                                                                                        \
     extra += " ";
 
 #define PREFIX_CODE()                                                                                                                                                                                                                                                                                                                                                                                          \
-    if (depth > maxDepth)                                                                                                                                                                                                                                                                                                                                                                                      \
+    if (depth > maxDepth || filter.prunes(syn))                                                                                                                                                                                                                                                                                                                                                                \
+        return;                                                                                                                                                                                                                                                                                                                                                                                                \
+    nodeName = syntaxNodeName(syn);                                                                                                                                                                                                                                                                                                                                                                            \
+    if (!filter.matchesSyntax(syn.kind, nodeName)) {                                                                                                                                                                                                                                                                                                                                                           \
+        visitUnlisted(syn);                                                                                                                                                                                                                                                                                                                                                                                    \
         return;                                                                                                                                                                                                                                                                                                                                                                                                \
-    std::string prefix = createPrefix();                                                                                                                                                                                                                                                                                                                                                                       \
-    std::string extra  = "";                                                                                                                                                                                                                                                                                                                                                                                   \
+    }                                                                                                                                                                                                                                                                                                                                                                                                          \
+    /* Records carry no extra text, so only the text format pays for building it. */                                                                                                                                                                                                                                                                                                                           \
+    if (format != ListFormat::Text) {                                                                                                                                                                                                                                                                                                                                                                          \
+        PRINT_INFO_AND_VISIT();                                                                                                                                                                                                                                                                                                                                                                                \
+        return;                                                                                                                                                                                                                                                                                                                                                                                                \
+    }                                                                                                                                                                                                                                                                                                                                                                                                          \
+    extra.clear();                                                                                                                                                                                                                                                                                                                                                                                             \
     SYNTAX_NAME();
 
 #define PRINT_INFO_AND_VISIT()                                                                                                                                                                                                                                                                                                                                                                                 \
     do {                                                                                                                                                                                                                                                                                                                                                                                                       \
-        fmt::println("{}[{}] depth: {}\tsynKind: {}\t{}", prefix, count, depth, toString(syn.kind), extra);                                                                                                                                                                                                                                                                                                    \
+        emit(syn);                                                                                                                                                                                                                                                                                                                                                                                             \
+        parentIds.push_back(count);                                                                                                                                                                                                                                                                                                                                                                            \
         count++;                                                                                                                                                                                                                                                                                                                                                                                               \
-        lastChildStack.push_back(false);                                                                                                                                                                                                                                                                                                                                                                       \
+        prefix.push(false);                                                                                                                                                                                                                                                                                                                                                                                    \
         depth++;                                                                                                                                                                                                                                                                                                                                                                                               \
         visitDefault(syn);                                                                                                                                                                                                                                                                                                                                                                                     \
-        lastChildStack.pop_back();                                                                                                                                                                                                                                                                                                                                                                             \
+        prefix.pop();                                                                                                                                                                                                                                                                                                                                                                                          \
+        parentIds.pop_back();                                                                                                                                                                                                                                                                                                                                                                                  \
         depth--;                                                                                                                                                                                                                                                                                                                                                                                               \
     } while (0)
 
@@ -114,7 +1199,7 @@ class SynaxLister : public SyntaxVisitor<SynaxLister> {
         PREFIX_CODE();
 
         extra += "moduleName: ";
-        extra += syn.header->name.rawText();
+        extra += nodeName;
 
         PRINT_INFO_AND_VISIT();
     }
@@ -147,7 +1232,7 @@ class SynaxLister : public SyntaxVisitor<SynaxLister> {
         PREFIX_CODE();
 
         extra += " name: ";
-        extra += syn.identifier.rawText();
+        extra += nodeName;
         extra += " ";
 
         PRINT_INFO_AND_VISIT();
@@ -157,7 +1242,7 @@ class SynaxLister : public SyntaxVisitor<SynaxLister> {
         PREFIX_CODE();
 
         extra += " name: ";
-        extra += syn.identifier.rawText();
+        extra += nodeName;
         extra += " ";
 
         PRINT_INFO_AND_VISIT();
@@ -172,7 +1257,8 @@ class SynaxLister : public SyntaxVisitor<SynaxLister> {
     void handle(const BinaryExpressionSyntax &syn) {
         PREFIX_CODE();
 
-        if (syn.kind == SyntaxKind::NonblockingAssignmentExpression && findAlwaysBlock(&syn)) {
+        auto procedure = context().procedure;
+        if (syn.kind == SyntaxKind::NonblockingAssignmentExpression && procedure != nullptr && procedure->kind == SyntaxKind::AlwaysBlock) {
             extra += " binExprNonblocking: ";
             extra += syn.toString();
             if (syn.getChildCount() > 0) {
@@ -207,22 +1293,6 @@ class SynaxLister : public SyntaxVisitor<SynaxLister> {
         PRINT_INFO_AND_VISIT();
     }
 
-    // const SyntaxNode *findAlwaysBlock(const SyntaxNode *syn) {
-    bool findAlwaysBlock(const SyntaxNode *syn) {
-        if (syn->kind == SyntaxKind::AlwaysBlock) {
-            // fmt::println("found always block!");
-            // return syn;
-            return true;
-        }
-
-        if (syn->parent == nullptr) {
-            // assert(false && "Not found always block!");
-            return false;
-        }
-
-        return findAlwaysBlock(syn->parent);
-    }
-
     void handle(const auto &syn) {
         PREFIX_CODE();
 
@@ -236,17 +1306,6 @@ class SynaxLister : public SyntaxVisitor<SynaxLister> {
     //     PRINT_INFO_AND_VISIT();
     // }
 
-    std::string createPrefix() {
-        std::string result;
-        for (size_t j = 0; j < lastChildStack.size(); ++j) {
-            if (j == lastChildStack.size() - 1) {
-                result += lastChildStack[j] ? "└─ " : "├─ ";
-            } else {
-                result += lastChildStack[j] ? "    " : "│   ";
-            }
-        }
-        return result;
-    }
 #undef SYNTAX_NAME()
 #undef PREFIX_CODE()
 #undef PRINT_INFO_AND_VISIT()
@@ -258,20 +1317,121 @@ template <typename, typename = std::void_t<>> struct has_getSyntax : std::false_
 // Specialization that detects the presence of a method
 template <typename T> struct has_getSyntax<T, std::void_t<decltype(std::declval<T>().getSyntax())>> : std::true_type {};
 
+// The chunks of a parallel listing: the members of the root other than top-level instances, and the members of the
+// top-level instance bodies. The skeleton lister lists everything above them and leaves a gap in its output for each.
+struct ListSplit {
+    struct Chunk {
+        const Symbol *symbol;
+        uint64_t depth;
+        TreePrefix prefix;
+        std::vector<uint64_t> parentIds;
+        uint64_t offset; // id of the first node listed by the chunk
+        size_t position; // where the chunk goes in the skeleton output
+    };
+
+    const MemorySink &skeleton;
+    std::vector<Chunk> chunks;
+    // Listed nodes per chunk, empty while the chunks are being found.
+    std::vector<uint64_t> counts;
+};
+
 class ASTLister : public ASTVisitor<ASTLister, true, true> {
   public:
     const uint64_t maxDepth;
     uint64_t depth = 0;
     uint64_t count = 0;
-    std::vector<bool> lastChildStack;
+    TreePrefix prefix;
+    std::string extra;
+    std::vector<uint64_t> parentIds;
+    const ListFormat format;
+    // Shared by the listers of a parallel listing, so a name regex is compiled once per listing.
+    const std::shared_ptr<const ListMatcher> matcher;
+    const ListMatcher &filter;
+    ListerOutput out;
+
+    // Only count the nodes that would be listed, used to number the chunks of a parallel listing up front.
+    bool countOnly = false;
+
+    // Set on the skeleton lister of a parallel listing, which leaves the chunks to other listers.
+    ListSplit *split = nullptr;
+
+    ASTLister(ListerSink &sink, uint64_t maxDepth, ListFormat format, std::shared_ptr<const ListMatcher> matcher) : maxDepth(maxDepth), format(format), matcher(std::move(matcher)), filter(*this->matcher), out(sink) {}
+
+    ASTLister(ListerSink &sink, uint64_t maxDepth = 10000, ListFormat format = ListFormat::Text, const ListFilter &filter = {}) : ASTLister(sink, maxDepth, format, std::make_shared<const ListMatcher>(filter)) {}
+
+    // Descends into a node that is not printed, either because the filter rejects it or because we are only
+    // counting. Returns false if the node is to be printed instead.
+    template <typename T> bool visitUnlisted(const T &ast) {
+        bool listed = filter.matchesAST(ast);
+        if (listed && !countOnly) {
+            return false;
+        }
+        if (listed) {
+            count++;
+        }
+        depth++;
+        descend(ast);
+        depth--;
+        return true;
+    }
+
+    template <typename T> void descend(const T &ast) {
+        if constexpr (std::is_same_v<T, RootSymbol> || std::is_same_v<T, InstanceBodySymbol>) {
+            // Members of the root are at depth 1, members of top-level instance bodies at depth 3.
+            if (split != nullptr && depth == (std::is_same_v<T, RootSymbol> ? 1 : 3)) {
+                for (auto &member : ast.members()) {
+                    if (std::is_same_v<T, RootSymbol> && member.kind == SymbolKind::Instance) {
+                        member.visit(*this);
+                    } else {
+                        defer(member);
+                    }
+                }
+                return;
+            }
+        }
+        visitDefault(ast);
+    }
+
+    // Leaves member to a chunk lister, skipping the ids it will take once they are known.
+    void defer(const Symbol &member) {
+        out.finish();
+        auto index = split->chunks.size();
+        split->chunks.push_back({&member, depth, prefix, parentIds, count, split->skeleton.buffer.size()});
+        if (index < split->counts.size()) {
+            count += split->counts[index];
+        }
+    }
+
+    template <typename T> void emit(const T &ast) {
+        if (format == ListFormat::Text) {
+            out.println("{}{}[{}] depth: {}\tastKind: {}\t{}", prefix.indentation(), prefix.branch(), count, depth, toString(ast.kind), extra);
+            return;
+        }
 
-    ASTLister(uint64_t maxDepth = 10000) : maxDepth(maxDepth) {}
+        ListRecord record{count, parentIds.empty() ? noParent : parentIds.back(), static_cast<uint16_t>(ast.kind), toString(ast.kind), typeNameOf<T>, ListRecordCategory::Other, depth, {}, SourceRange(), 0};
+        if constexpr (std::is_base_of_v<Symbol, T>) {
+            record.category = ListRecordCategory::Symbol;
+            record.name     = ast.name;
+            auto syntax     = ast.getSyntax();
+            record.range    = syntax != nullptr ? syntax->sourceRange() : SourceRange(ast.location, ast.location);
+            if constexpr (std::is_base_of_v<ValueSymbol, T>) {
+                record.width = ast.getType().getBitWidth();
+            }
+        } else if constexpr (std::is_base_of_v<Statement, T>) {
+            record.category = ListRecordCategory::Statement;
+            record.range    = ast.sourceRange;
+        } else if constexpr (std::is_base_of_v<Expression, T>) {
+            record.category = ListRecordCategory::Expression;
+            record.range    = ast.sourceRange;
+            record.width    = ast.type->getBitWidth();
+        }
+        writeListRecord(out, format, record);
+    }
 
     // clang-format off
     #define AST_NAME() \
         extra += "\tastName: "; \
-        auto name = boost::typeindex::type_id<decltype(ast)>().pretty_name(); \
-        extra += std::string(name); \
+        extra += typeNameOf<decltype(ast)>; \
         extra += " "; \
         extra += "\tsynKindName: ";  \
         if constexpr (has_getSyntax<decltype(ast)>::value) { \
@@ -287,20 +1447,28 @@ class ASTLister : public ASTVisitor<ASTLister, true, true> {
         }
 
     #define PREFIX_CODE() \
-        if (depth > maxDepth) \
+        if (depth > maxDepth || filter.prunes(ast)) \
+            return; \
+        if (visitUnlisted(ast)) \
             return; \
-        std::string prefix = createPrefix(); \
-        std::string extra = ""; \
+        /* Records carry no extra text, so only the text format pays for building it. */ \
+        if (format != ListFormat::Text) { \
+            PRINT_INFO_AND_VISIT(); \
+            return; \
+        } \
+        extra.clear(); \
         AST_NAME();
 
     #define PRINT_INFO_AND_VISIT() \
         do { \
-            fmt::println("{}[{}] depth: {}\tastKind: {}\t{}", prefix, count, depth, toString(ast.kind), extra); \
+            emit(ast); \
+            parentIds.push_back(count); \
             count++; \
-            lastChildStack.push_back(false); \
+            prefix.push(false); \
             depth++; \
-            visitDefault(ast); \
-            lastChildStack.pop_back(); \
+            descend(ast); \
+            prefix.pop(); \
+            parentIds.pop_back(); \
             depth--; \
         } while(0)
     // clang-format on
@@ -336,8 +1504,7 @@ class ASTLister : public ASTVisitor<ASTLister, true, true> {
         extra += " dataType: ";
         extra += dataType;
 
-        extra += " bitWidth: ";
-        extra += fmt::format("{}", bitWidth);
+        fmt::format_to(std::back_inserter(extra), " bitWidth: {}", bitWidth);
 
         PRINT_INFO_AND_VISIT();
     }
@@ -351,12 +1518,12 @@ class ASTLister : public ASTVisitor<ASTLister, true, true> {
         auto &internalKind = port.internalSymbol->kind;
         auto &pTypeKind    = pType.kind;
 
-        extra += fmt::format(" portName: {} dir: {} internalKind: {} portWidth: {} portType: {} portTypeKind: {}", port.name, toString(port.direction), toString(internalKind), pType.getBitWidth(), pType.toString(), toString(pType.kind));
+        fmt::format_to(std::back_inserter(extra), " portName: {} dir: {} internalKind: {} portWidth: {} portType: {} portTypeKind: {}", port.name, toString(port.direction), toString(internalKind), pType.getBitWidth(), pType.toString(), toString(pType.kind));
 
         if (internalKind == SymbolKind::Net) {
             auto &net  = port.internalSymbol->as<NetSymbol>();
             auto dType = net.netType.getDataType().toString();
-            extra += fmt::format(" dataType: {}", dType);
+            fmt::format_to(std::back_inserter(extra), " dataType: {}", dType);
         } else if (internalKind == SymbolKind::Variable) {
             auto &var = port.internalSymbol->as<VariableSymbol>();
         } else {
@@ -376,62 +1543,483 @@ class ASTLister : public ASTVisitor<ASTLister, true, true> {
         PRINT_INFO_AND_VISIT();
     }
 
-    std::string createPrefix() {
-        std::string result;
-        for (size_t j = 0; j < lastChildStack.size(); ++j) {
-            if (j == lastChildStack.size() - 1) {
-                result += lastChildStack[j] ? "└─ " : "├─ ";
-            } else {
-                result += lastChildStack[j] ? "    " : "│   ";
-            }
-        }
-        return result;
-    }
 #undef AST_NAME()
 #undef PREFIX_CODE()
 #undef PRINT_INFO_AND_VISIT()
 };
 
-void listAST(std::shared_ptr<SyntaxTree> tree, uint64_t maxDepth = 1000) {
+// Lists the chunks of the design (see ListSplit) on the worker pool and everything above them, the root and the top-level
+// instances with their bodies, on the calling thread. So that a design with a single top is split as well, the split
+// goes one level below the top instances. Counting passes number the chunks up front, so ids and the chunk outputs,
+// put into the gaps of the skeleton output, come out byte-identical to a single-threaded listing.
+static void listRootParallel(Compilation &compilation, ListerSink &sink, const ListOptions &options) {
+    // Elaborate everything up front so the workers only read the frozen design. A compilation the caller already froze
+    // is taken as elaborated and left frozen.
+    bool froze = !compilation.isFrozen();
+    if (froze) {
+        compilation.getAllDiagnostics();
+        compilation.freeze();
+    }
+
+    // std::regex matching is const, so all listers share one compiled filter.
+    auto matcher = std::make_shared<const ListMatcher>(options.filter);
+    auto &root   = compilation.getRoot();
+
+    // Find the chunks; depth and symbol do not depend on the ids, so a counting skeleton is enough.
+    MemorySink unused;
+    ListSplit found{unused};
+    {
+        ASTLister finder(unused, options.maxDepth, options.format, matcher);
+        finder.countOnly = true;
+        finder.split     = &found;
+        root.visit(finder);
+    }
+
+    std::vector<uint64_t> counts(found.chunks.size());
+    parallelFor(found.chunks.size(), options.threads, [&](size_t i) {
+        MemorySink discarded;
+        ASTLister counter(discarded, options.maxDepth, options.format, matcher);
+        counter.countOnly = true;
+        counter.depth     = found.chunks[i].depth;
+        found.chunks[i].symbol->visit(counter);
+        counts[i] = counter.count;
+    });
+
+    // The real skeleton, which now knows how many ids each chunk takes.
+    MemorySink skeletonSink;
+    ListSplit split{skeletonSink};
+    split.counts = std::move(counts);
+    {
+        ASTLister skeleton(skeletonSink, options.maxDepth, options.format, matcher);
+        skeleton.split = &split;
+        writeListHeader(skeleton.out, options.format, true);
+        root.visit(skeleton);
+        skeleton.out.finish();
+    }
+
+    std::vector<MemorySink> chunks(split.chunks.size());
+    parallelFor(split.chunks.size(), options.threads, [&](size_t i) {
+        auto &chunk = split.chunks[i];
+        ASTLister lister(chunks[i], options.maxDepth, options.format, matcher);
+        lister.count     = chunk.offset;
+        lister.depth     = chunk.depth;
+        lister.prefix    = chunk.prefix;
+        lister.parentIds = chunk.parentIds;
+        chunk.symbol->visit(lister);
+        lister.out.finish();
+    });
+
+    std::string_view skeletonText = skeletonSink.buffer;
+    size_t written                = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        auto position = split.chunks[i].position;
+        sink.write(skeletonText.substr(written, position - written));
+        sink.write(chunks[i].buffer);
+        written = position;
+    }
+    sink.write(skeletonText.substr(written));
+    sink.flush();
+
+    if (froze) {
+        compilation.unfreeze();
+    }
+}
+
+// The symbol at a ListFilter::rootPath, looked up as a hierarchical name from scope.
+static const Symbol *findListRoot(const Scope &scope, std::string_view path) { return scope.lookupName(path); }
+
+// The module declaration at a ListFilter::rootPath below node. Only members are searched, one path component per
+// level of module nesting, so no expressions and no non-matching modules are walked.
+static const SyntaxNode *findListRoot(const SyntaxNode &node, std::string_view path) {
+    auto dot  = path.find('.');
+    auto name = path.substr(0, dot);
+    for (uint32_t i = 0; i < node.getChildCount(); i++) {
+        auto child = node.childNode(i);
+        if (child == nullptr || ExpressionSyntax::isKind(child->kind)) {
+            continue;
+        }
+        if (ModuleDeclarationSyntax::isKind(child->kind)) {
+            if (child->as<ModuleDeclarationSyntax>().header->name.rawText() != name) {
+                continue;
+            }
+            if (dot == std::string_view::npos) {
+                return child;
+            }
+            if (auto found = findListRoot(*child, path.substr(dot + 1))) {
+                return found;
+            }
+            continue;
+        }
+        if (auto found = findListRoot(*child, path)) {
+            return found;
+        }
+    }
+    return nullptr;
+}
+
+// Lists the symbol at rootPath below scope, or the scope itself.
+static void listASTFrom(const Scope &scope, ListerSink &sink, const ListOptions &options) {
+    auto start = &scope.asSymbol();
+    if (!options.filter.rootPath.empty()) {
+        start = findListRoot(scope, options.filter.rootPath);
+        if (start == nullptr) {
+            fmt::println(stderr, "[list] rootPath not found: {}", options.filter.rootPath);
+            return;
+        }
+    }
+
+    ASTLister visitor(sink, options.maxDepth, options.format, options.filter);
+    writeListHeader(visitor.out, options.format, true);
+    start->visit(visitor);
+}
+
+void listAST(std::shared_ptr<SyntaxTree> tree, const ListOptions &options) {
     Compilation compilation;
     compilation.addSyntaxTree(tree);
-
-    ASTLister visitor(maxDepth);
-    compilation.getRoot().visit(visitor);
+    listAST(compilation, options);
 }
 
-void listSyntaxTree(std::shared_ptr<SyntaxTree> tree, uint64_t maxDepth = 1000) {
-    SynaxLister sl(maxDepth);
-    tree->root().visit(sl);
+void listAST(Compilation &compilation, const ListOptions &options) {
+    FileSink stdoutSink(stdout);
+    auto &sink = options.sink != nullptr ? *options.sink : stdoutSink;
+    if (options.threads != 1 && options.filter.rootPath.empty()) {
+        listRootParallel(compilation, sink, options);
+        return;
+    }
+
+    listASTFrom(compilation.getRoot(), sink, options);
 }
 
-void listSyntaxNode(const SyntaxNode &node, uint64_t maxDepth = 1000) {
-    SynaxLister sl(maxDepth);
-    node.visit(sl);
+void listSyntaxTree(std::shared_ptr<SyntaxTree> tree, const ListOptions &options) { listSyntaxNode(tree->root(), options); }
+
+void listSyntaxNode(const SyntaxNode &node, const ListOptions &options) {
+    auto start = &node;
+    if (!options.filter.rootPath.empty()) {
+        start = findListRoot(node, options.filter.rootPath);
+        if (start == nullptr) {
+            fmt::println(stderr, "[list] rootPath not found: {}", options.filter.rootPath);
+            return;
+        }
+    }
+
+    FileSink stdoutSink(stdout);
+    SynaxLister sl(options.sink != nullptr ? *options.sink : stdoutSink, options.maxDepth, options.format, options.filter);
+    writeListHeader(sl.out, options.format, false);
+    sl.seedContext(*start);
+    start->visit(sl);
 }
 
-void listASTNode(std::shared_ptr<SyntaxTree> tree, const ModuleDeclarationSyntax &syntax, uint64_t maxDepth = 1000) {
+void listASTNode(std::shared_ptr<SyntaxTree> tree, const ModuleDeclarationSyntax &syntax, const ListOptions &options) {
     Compilation compilation;
     compilation.addSyntaxTree(tree);
+    listASTNode(compilation, syntax, options);
+}
+
+void listASTNode(Compilation &compilation, const ModuleDeclarationSyntax &syntax, const ListOptions &options) {
+    DefaultInstanceCache cache(compilation);
+    listASTNode(cache, syntax, options);
+}
+
+void listASTNode(DefaultInstanceCache &cache, const ModuleDeclarationSyntax &syntax, const ListOptions &options) {
+    auto inst = cache.get(syntax);
+    if (inst == nullptr) {
+        fmt::println(stderr, "[listASTNode] no definition for: {}", syntax.header->name.rawText());
+        return;
+    }
+    listASTNode(*inst, options);
+}
+
+void listASTNode(const InstanceSymbol &instance, const ListOptions &options) {
+    FileSink stdoutSink(stdout);
+    listASTFrom(instance.body, options.sink != nullptr ? *options.sink : stdoutSink, options);
+}
+
+void listAST(std::shared_ptr<SyntaxTree> tree, uint64_t maxDepth = 1000) { listAST(tree, ListOptions{.maxDepth = maxDepth}); }
+
+void listSyntaxTree(std::shared_ptr<SyntaxTree> tree, uint64_t maxDepth = 1000) { listSyntaxTree(tree, ListOptions{.maxDepth = maxDepth}); }
+
+void listSyntaxNode(const SyntaxNode &node, uint64_t maxDepth = 1000) { listSyntaxNode(node, ListOptions{.maxDepth = maxDepth}); }
+
+void listASTNode(std::shared_ptr<SyntaxTree> tree, const ModuleDeclarationSyntax &syntax, uint64_t maxDepth = 1000) { listASTNode(tree, syntax, ListOptions{.maxDepth = maxDepth}); }
+
+static void countKind(std::vector<uint64_t> &counts, size_t kind) {
+    if (counts.size() <= kind) {
+        counts.resize(kind + 1);
+    }
+    counts[kind]++;
+}
+
+class SyntaxStatsVisitor : public SyntaxVisitor<SyntaxStatsVisitor> {
+  public:
+    DesignStats &stats;
+    uint64_t depth = 0;
+
+    explicit SyntaxStatsVisitor(DesignStats &stats) : stats(stats) {}
+
+    template <typename T> void handle(const T &syn) {
+        countKind(stats.syntaxKindCounts, static_cast<size_t>(syn.kind));
+        stats.syntaxNodes++;
+        stats.syntaxBytes   += sizeof(T);
+        stats.maxSyntaxDepth = std::max(stats.maxSyntaxDepth, depth);
+
+        depth++;
+        visitDefault(syn);
+        depth--;
+    }
+};
+
+class ASTStatsVisitor : public ASTVisitor<ASTStatsVisitor, true, true> {
+  public:
+    DesignStats &stats;
+    uint64_t depth = 0;
+
+    explicit ASTStatsVisitor(DesignStats &stats) : stats(stats) {}
+
+    template <typename T> void handle(const T &ast) {
+        if constexpr (std::is_base_of_v<Symbol, T>) {
+            countKind(stats.symbolKindCounts, static_cast<size_t>(ast.kind));
+        }
+        if constexpr (std::is_same_v<T, InstanceSymbol>) {
+            stats.instances++;
+        } else if constexpr (std::is_same_v<T, NetSymbol>) {
+            stats.nets++;
+        } else if constexpr (std::is_same_v<T, PortSymbol>) {
+            stats.ports++;
+        }
+        stats.astNodes++;
+        stats.astBytes   += sizeof(T);
+        stats.maxASTDepth = std::max(stats.maxASTDepth, depth);
 
-    ASTLister visitor(maxDepth);
-    const auto def = compilation.getDefinition(compilation.getRoot(), syntax);
-    auto inst      = &InstanceSymbol::createDefault(compilation, def->as<DefinitionSymbol>());
-    inst->body.visit(visitor);
+        depth++;
+        visitDefault(ast);
+        depth--;
+    }
+};
+
+DesignStats collectSyntaxStats(const SyntaxNode &node) {
+    DesignStats stats;
+    SyntaxStatsVisitor visitor(stats);
+    node.visit(visitor);
+    return stats;
+}
+
+DesignStats collectDesignStats(Compilation &compilation) {
+    DesignStats stats;
+    SyntaxStatsVisitor syntaxVisitor(stats);
+    for (auto &tree : compilation.getSyntaxTrees()) {
+        tree->root().visit(syntaxVisitor);
+    }
+
+    ASTStatsVisitor astVisitor(stats);
+    compilation.getRoot().visit(astVisitor);
+    return stats;
+}
+
+DesignStats collectDesignStats(std::shared_ptr<SyntaxTree> tree) {
+    Compilation compilation;
+    compilation.addSyntaxTree(tree);
+    return collectDesignStats(compilation);
 }
 
 const DefinitionSymbol *getDefSymbol(std::shared_ptr<SyntaxTree> tree, const ModuleDeclarationSyntax &syntax) {
     Compilation compilation;
     compilation.addSyntaxTree(tree);
 
-    return compilation.getDefinition(compilation.getRoot(), syntax);
+    return getDefSymbol(compilation, syntax);
 }
 
+const DefinitionSymbol *getDefSymbol(Compilation &compilation, const ModuleDeclarationSyntax &syntax) { return compilation.getDefinition(compilation.getRoot(), syntax); }
+
 const InstanceSymbol *getInstSymbol(Compilation &compilation, const ModuleDeclarationSyntax &syntax) {
     auto def = compilation.getDefinition(compilation.getRoot(), syntax);
+    if (def == nullptr) {
+        return nullptr;
+    }
     return &InstanceSymbol::createDefault(compilation, def->as<DefinitionSymbol>());
 }
 
+const InstanceSymbol &DefaultInstanceCache::get(const DefinitionSymbol &definition) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto [it, inserted] = instances.try_emplace(&definition, nullptr);
+    if (inserted) {
+        it->second = &InstanceSymbol::createDefault(compilation, definition);
+    }
+    return *it->second;
+}
+
+const InstanceSymbol *DefaultInstanceCache::get(const ModuleDeclarationSyntax &syntax) {
+    auto def = compilation.getDefinition(compilation.getRoot(), syntax);
+    if (def == nullptr) {
+        return nullptr;
+    }
+    return &get(def->as<DefinitionSymbol>());
+}
+
+const InstanceSymbol *getInstSymbol(DefaultInstanceCache &cache, const ModuleDeclarationSyntax &syntax) { return cache.get(syntax); }
+
+DefinitionIndex::DefinitionIndex(Compilation &compilation) {
+    auto &root = compilation.getRoot();
+    auto add   = [&](const ModuleDeclarationSyntax &syntax) {
+        auto name = syntax.header->name.rawText();
+        if (syntax.kind == SyntaxKind::PackageDeclaration) {
+            if (auto package = compilation.getPackage(name)) {
+                entries[name].package = package;
+            }
+        } else if (auto def = compilation.getDefinition(root, syntax)) {
+            entries[name].definition = &def->as<DefinitionSymbol>();
+        }
+    };
+
+    for (auto &tree : compilation.getSyntaxTrees()) {
+        auto &node = tree->root();
+        if (node.kind == SyntaxKind::CompilationUnit) {
+            for (auto member : node.as<CompilationUnitSyntax>().members) {
+                if (ModuleDeclarationSyntax::isKind(member->kind)) {
+                    add(member->as<ModuleDeclarationSyntax>());
+                }
+            }
+        } else if (ModuleDeclarationSyntax::isKind(node.kind)) {
+            add(node.as<ModuleDeclarationSyntax>());
+        }
+    }
+
+    sortedNames.reserve(entries.size());
+    for (auto &[name, entry] : entries) {
+        sortedNames.push_back(name);
+    }
+    std::sort(sortedNames.begin(), sortedNames.end());
+}
+
+const DefinitionIndex::Entry *DefinitionIndex::find(std::string_view name) const {
+    auto it = entries.find(name);
+    return it != entries.end() ? &it->second : nullptr;
+}
+
+const DefinitionSymbol *DefinitionIndex::findDefinition(std::string_view name) const {
+    auto entry = find(name);
+    return entry != nullptr ? entry->definition : nullptr;
+}
+
+const PackageSymbol *DefinitionIndex::findPackage(std::string_view name) const {
+    auto entry = find(name);
+    return entry != nullptr ? entry->package : nullptr;
+}
+
+std::span<const std::string_view> DefinitionIndex::withPrefix(std::string_view prefix) const {
+    auto first = std::lower_bound(sortedNames.begin(), sortedNames.end(), prefix);
+    auto last  = std::find_if(first, sortedNames.end(), [&](std::string_view name) { return !name.starts_with(prefix); });
+    return {first, last};
+}
+
+std::vector<std::string_view> DefinitionIndex::matching(std::string_view glob) const {
+    std::vector<std::string_view> result;
+    for (auto name : withPrefix(glob.substr(0, glob.find_first_of("*?")))) {
+        if (globMatch(glob, name)) {
+            result.push_back(name);
+        }
+    }
+    return result;
+}
+
+// Syntax that opens a scope of its own below a module, whose declarations are not visible by plain name in the module.
+static bool opensScope(SyntaxKind kind) {
+    switch (kind) {
+    case SyntaxKind::FunctionDeclaration:
+    case SyntaxKind::TaskDeclaration:
+    case SyntaxKind::ClassDeclaration:
+    case SyntaxKind::CovergroupDeclaration:
+    case SyntaxKind::PropertyDeclaration:
+    case SyntaxKind::SequenceDeclaration:
+    case SyntaxKind::CheckerDeclaration:
+    case SyntaxKind::SequentialBlockStatement:
+    case SyntaxKind::ParallelBlockStatement:
+    case SyntaxKind::GenerateBlock:
+    case SyntaxKind::IfGenerate:
+    case SyntaxKind::CaseGenerate:
+    case SyntaxKind::LoopGenerate:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Adds the declarations below node to names in pre-order. Expressions declare nothing and nested modules are indexed
+// on their own, so neither is entered, nor are nested scopes (see opensScope), nor the declarations themselves once
+// their names are taken.
+static void collectDeclarations(const SyntaxNode &node, flat_hash_map<std::string_view, std::vector<const SyntaxNode *>> &names) {
+    auto addDeclarators = [&](const SyntaxNode &declaration, const auto &declarators) {
+        for (auto declarator : declarators) {
+            names[declarator->name.rawText()].push_back(&declaration);
+        }
+    };
+
+    for (uint32_t i = 0; i < node.getChildCount(); i++) {
+        auto child = node.childNode(i);
+        if (child == nullptr || ExpressionSyntax::isKind(child->kind) || ModuleDeclarationSyntax::isKind(child->kind) || opensScope(child->kind)) {
+            continue;
+        }
+
+        switch (child->kind) {
+        case SyntaxKind::NetDeclaration:
+            addDeclarators(*child, child->as<NetDeclarationSyntax>().declarators);
+            break;
+        case SyntaxKind::DataDeclaration:
+            addDeclarators(*child, child->as<DataDeclarationSyntax>().declarators);
+            break;
+        case SyntaxKind::PortDeclaration:
+            addDeclarators(*child, child->as<PortDeclarationSyntax>().declarators);
+            break;
+        case SyntaxKind::ParameterDeclaration:
+            addDeclarators(*child, child->as<ParameterDeclarationSyntax>().declarators);
+            break;
+        case SyntaxKind::TypeParameterDeclaration:
+            addDeclarators(*child, child->as<TypeParameterDeclarationSyntax>().declarators);
+            break;
+        case SyntaxKind::ImplicitAnsiPort:
+            names[child->as<ImplicitAnsiPortSyntax>().declarator->name.rawText()].push_back(child);
+            break;
+        default:
+            collectDeclarations(*child, names);
+            break;
+        }
+    }
+}
+
+const DeclarationIndex::NameMap &DeclarationIndex::build(const ModuleDeclarationSyntax &module) {
+    auto [it, inserted] = modules.try_emplace(&module);
+    if (inserted) {
+        collectDeclarations(module, it->second);
+    }
+    return it->second;
+}
+
+std::span<const SyntaxNode *const> DeclarationIndex::findAll(const ModuleDeclarationSyntax &module, std::string_view name) {
+    auto &names = build(module);
+    auto it     = names.find(name);
+    if (it == names.end()) {
+        return {};
+    }
+    return it->second;
+}
+
+const SyntaxNode *DeclarationIndex::find(const ModuleDeclarationSyntax &module, std::string_view name, SyntaxKind kind) {
+    for (auto declaration : findAll(module, name)) {
+        if (kind == SyntaxKind::Unknown || declaration->kind == kind) {
+            return declaration;
+        }
+    }
+    return nullptr;
+}
+
+const SyntaxNode *DeclarationIndex::find(const SyntaxNode &node, std::string_view name, SyntaxKind kind) {
+    for (auto current = &node; current != nullptr; current = current->parent) {
+        if (ModuleDeclarationSyntax::isKind(current->kind)) {
+            return find(current->as<ModuleDeclarationSyntax>(), name, kind);
+        }
+    }
+    return nullptr;
+}
+
 const SyntaxNode *getNetDeclarationSyntax(const SyntaxNode *node, std::string_view identifierName, bool reverse) {
     if (node == nullptr) {
         return nullptr;
@@ -439,9 +2027,10 @@ const SyntaxNode *getNetDeclarationSyntax(const SyntaxNode *node, std::string_vi
 
     if (node->kind == SyntaxKind::NetDeclaration) {
         auto &netDeclSyn = node->as<NetDeclarationSyntax>();
-        auto t           = netDeclSyn.declarators[0]->as<DeclaratorSyntax>().name.rawText();
-        if (t == identifierName) {
-            return node;
+        for (auto declarator : netDeclSyn.declarators) {
+            if (declarator->name.rawText() == identifierName) {
+                return node;
+            }
         }
     }
 
@@ -462,4 +2051,26 @@ const SyntaxNode *getNetDeclarationSyntax(const SyntaxNode *node, std::string_vi
     return nullptr;
 }
 
-} // namespace slang_common
\ No newline at end of file
+void writeChromeTrace(std::span<const RebuildStats> stats, std::FILE *file) {
+    // One trace "thread" per rebuild so the phases of a batch line up next to each other.
+    auto epoch = std::chrono::steady_clock::time_point::max();
+    for (auto &s : stats) {
+        for (auto &phase : s.phases) {
+            epoch = std::min(epoch, phase.start);
+        }
+    }
+
+    fmt::print(file, "{{\"traceEvents\":[");
+    bool first = true;
+    for (size_t tid = 0; tid < stats.size(); tid++) {
+        for (auto &phase : stats[tid].phases) {
+            auto ts  = std::chrono::duration<double, std::micro>(phase.start - epoch).count();
+            auto dur = std::chrono::duration<double, std::micro>(phase.duration).count();
+            fmt::print(file, "{}\n{{\"name\":\"{}\",\"cat\":\"rebuild\",\"ph\":\"X\",\"pid\":0,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{\"bytes\":{},\"tokens\":{},\"heapBytes\":{}}}}}", first ? "" : ",", phase.name, tid, ts, dur, phase.bytes, phase.tokens, phase.heapBytes);
+            first = false;
+        }
+    }
+    fmt::print(file, "\n]}}\n");
+}
+
+} // namespace slang_common
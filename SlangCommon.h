@@ -8,6 +8,9 @@
 #include "slang/diagnostics/DiagnosticEngine.h"
 #include "slang/diagnostics/Diagnostics.h"
 #include "slang/diagnostics/TextDiagnosticClient.h"
+#include "slang/parsing/Lexer.h"
+#include "slang/parsing/Parser.h"
+#include "slang/parsing/Preprocessor.h"
 #include "slang/syntax/AllSyntax.h"
 #include "slang/syntax/SyntaxNode.h"
 #include "slang/syntax/SyntaxPrinter.h"
@@ -17,7 +20,17 @@
 #include "slang/text/SourceManager.h"
 #include "slang/util/LanguageVersion.h"
 #include "slang/util/Util.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 using namespace slang;
 using namespace slang::parsing;
@@ -28,19 +41,496 @@ namespace slang_common {
 
 bool checkDiagsError(Diagnostics &diags);
 
+// How much checking rebuildSyntaxTree does on the rebuilt tree before handing it out.
+enum class ValidationLevel {
+    None,      // no checks at all
+    ParseOnly, // syntax errors of the reparsed text only
+    Full       // syntax errors plus elaboration, limited to the hierarchies containing the touched definitions when they are known
+};
+
+class RebuildCache;
+
+enum class RebuildMode {
+    Reparse, // print the tree and parse the text again
+    Clone    // deep-clone the syntax into a fresh tree, falls back to Reparse when some token has to be lexed again
+};
+
+struct RebuildOptions {
+    RebuildMode mode           = RebuildMode::Reparse;
+    ValidationLevel validation = ValidationLevel::Full;
+
+    // Definitions to elaborate under ValidationLevel::Full, together with the modules instantiating them up to their
+    // tops. Empty means the whole design, the incremental rebuild adds the modules it reparsed on its own. The whole
+    // design is elaborated as well when a name is unknown or ends at a definition that cannot be a top.
+    std::vector<std::string> touchedDefinitions;
+
+    // SourceManager that receives the rebuilt buffer, nullptr means SyntaxTree::getDefaultSourceManager().
+    // A clone only honors it when it is the SourceManager of the old tree, otherwise the text path runs.
+    SourceManager *sourceManager = nullptr;
+
+    // Give the rebuilt tree a SourceManager of its own that is released together with the tree, so the buffers
+    // of superseded trees do not pile up in a shared SourceManager. Ignored when sourceManager is set.
+    //
+    // Only for trees that are used on their own: a Compilation resolves all of its trees' locations through one
+    // SourceManager, so such a tree cannot be combined with trees from any other SourceManager in one Compilation
+    // (validation is fine, it compiles the tree alone). Memory stays flat only for chains of text-path rebuilds of
+    // a standalone tree. Clone mode falls back to the text path when this is set, and the incremental rebuild
+    // ignores it and always stays in the SourceManager of its base tree.
+    bool scopedSourceManager = false;
+
+    // Optional cache of earlier rebuilds, consulted by the text path before parsing.
+    RebuildCache *cache = nullptr;
+
+    // Also count tokens and sample heap growth for every phase in RebuildStats (costs an extra tree walk).
+    bool detailedStats = false;
+
+    bool printTree = false;
+};
+
+// One step of a rebuild: printFile, fromFileInMemory, deepClone, splice, addSyntaxTree or getAllDiagnostics.
+struct RebuildPhase {
+    std::string_view name;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::nanoseconds duration{0};
+
+    uint64_t bytes  = 0; // text printed / parsed
+    uint64_t tokens = 0; // tokens in the parsed tree, detailed stats only
+
+    // Heap growth of the process while the phase ran (glibc 2.33 or newer only), detailed stats only.
+    int64_t heapBytes = 0;
+};
+
+struct RebuildStats {
+    std::vector<RebuildPhase> phases;
+
+    std::chrono::nanoseconds validationTime{0};
+
+    // The tree came out of a RebuildCache, nothing was parsed or validated.
+    bool cacheHit = false;
+};
+
+enum class RebuildError { None, Syntax, Compilation };
+
+struct RebuildResult {
+    std::shared_ptr<SyntaxTree> tree;
+    RebuildError error = RebuildError::None;
+
+    // Rendered diagnostics of the failing validation stage, empty if the tree is fine.
+    std::string diagnostics;
+
+    RebuildStats stats;
+};
+
+// Remembers rebuilt trees (and the outcome of their validation) by the text they were parsed from, the parse options,
+// the target SourceManager and the validation settings (RebuildOptions::validation and touchedDefinitions), so a
+// rewrite that prints to the same text as an earlier one gets the earlier tree back. All of these are stored with the
+// entry and compared on a hit, the hash only picks the candidate. Entries are evicted least recently used first once
+// either bound is exceeded. Safe to share between threads.
+class RebuildCache {
+  public:
+    explicit RebuildCache(size_t maxEntries = 64, size_t maxBytes = size_t(256) << 20) : maxEntries(maxEntries), maxBytes(maxBytes) {}
+
+    bool find(std::string_view text, const Bag &parseOptions, const SourceManager *sourceManager, const RebuildOptions &options, RebuildResult &result);
+
+    void insert(std::string text, const Bag &parseOptions, const SourceManager *sourceManager, const RebuildOptions &options, const RebuildResult &result);
+
+    void clear();
+
+    size_t size() const;
+
+    std::atomic<uint64_t> hits      = 0;
+    std::atomic<uint64_t> misses    = 0;
+    std::atomic<uint64_t> evictions = 0;
+
+  private:
+    // Everything that decides what a cached rebuild looks like besides its text.
+    struct Settings {
+        PreprocessorOptions preprocessor;
+        LexerOptions lexer;
+        ParserOptions parser;
+        const SourceManager *sourceManager;
+        ValidationLevel validation;
+        std::vector<std::string> touchedDefinitions; // sorted
+
+        Settings(const Bag &parseOptions, const SourceManager *sourceManager, const RebuildOptions &options);
+
+        bool operator==(const Settings &other) const;
+
+        size_t hash() const;
+    };
+
+    struct Entry {
+        size_t key;
+        std::string text;
+        Settings settings;
+        RebuildResult result;
+    };
+
+    const size_t maxEntries;
+    const size_t maxBytes;
+    size_t bytes = 0;
+
+    mutable std::mutex mutex;
+    std::list<Entry> entries;
+    flat_hash_map<size_t, std::list<Entry>::iterator> index;
+};
+
 std::shared_ptr<SyntaxTree> rebuildSyntaxTree(const SyntaxTree &oldTree, bool printTree = false);
 
+std::shared_ptr<SyntaxTree> rebuildSyntaxTree(const SyntaxTree &oldTree, const RebuildOptions &options, RebuildStats *stats = nullptr);
+
+// Same as above, but also honors RebuildOptions::mode: a clone stays in the SourceManager of `oldTree`, takes its parse
+// options and library, and keeps alive the tree its clone chain started from (`oldTree` itself on the first clone).
+std::shared_ptr<SyntaxTree> rebuildSyntaxTree(std::shared_ptr<SyntaxTree> oldTree, const RebuildOptions &options, RebuildStats *stats = nullptr);
+
+// Rebuild many trees at once on `threads` workers (0 means one per hardware thread). Results come back in input order;
+// instead of asserting, errors are reported per tree through RebuildResult. RebuildOptions::printTree is ignored.
+std::vector<RebuildResult> rebuildSyntaxTrees(std::span<const std::shared_ptr<SyntaxTree>> trees, const RebuildOptions &options, unsigned threads = 0);
+
+// Write the phases of one or more rebuilds as Chrome trace-event JSON (chrome://tracing, Perfetto), one track per rebuild.
+void writeChromeTrace(std::span<const RebuildStats> stats, std::FILE *file);
+
+// Rebuild `newTree` (the output of a rewriter applied to `baseTree`) by reparsing only the top-level members whose text differs from `baseTree`.
+// Unchanged module declarations are cloned over from `baseTree`, which is left untouched and not kept alive by the returned tree.
+std::shared_ptr<SyntaxTree> rebuildSyntaxTreeIncremental(std::shared_ptr<SyntaxTree> baseTree, const SyntaxTree &newTree, bool printTree = false);
+
+std::shared_ptr<SyntaxTree> rebuildSyntaxTreeIncremental(std::shared_ptr<SyntaxTree> baseTree, const SyntaxTree &newTree, const RebuildOptions &options, RebuildStats *stats = nullptr);
+
+// Constructs enclosing the node a SyntaxContextVisitor is currently at (nullptr where there is none).
+struct SyntaxContext {
+    const ModuleDeclarationSyntax *module     = nullptr;
+    const ProceduralBlockSyntax *procedure    = nullptr; // always*, initial or final block
+    const SyntaxNode *generate                = nullptr; // innermost generate block, loop, if, case or region
+    const FunctionDeclarationSyntax *function = nullptr; // function or task
+};
+
+// SyntaxVisitor that keeps track of the enclosing module, procedural block, generate scope and function while it
+// descends, so handlers can ask for them in O(1) through context() instead of walking the parent chain.
+// Derived classes visit children with visitDefault() as usual.
+template <typename TDerived> class SyntaxContextVisitor : public SyntaxVisitor<TDerived> {
+  public:
+    const SyntaxContext &context() const { return current; }
+
+    template <typename T> void visitDefault(T &&node) {
+        using TNode = std::remove_cvref_t<T>;
+        auto saved  = current;
+
+        if constexpr (std::is_base_of_v<ModuleDeclarationSyntax, TNode>) {
+            current = SyntaxContext{.module = &node};
+        } else if constexpr (std::is_base_of_v<ProceduralBlockSyntax, TNode>) {
+            current.procedure = &node;
+        } else if constexpr (std::is_base_of_v<GenerateBlockSyntax, TNode> || std::is_base_of_v<LoopGenerateSyntax, TNode> || std::is_base_of_v<IfGenerateSyntax, TNode> || std::is_base_of_v<CaseGenerateSyntax, TNode> || std::is_base_of_v<GenerateRegionSyntax, TNode>) {
+            current.generate = &node;
+        } else if constexpr (std::is_base_of_v<FunctionDeclarationSyntax, TNode>) {
+            current.function = &node;
+        }
+
+        SyntaxVisitor<TDerived>::visitDefault(std::forward<T>(node));
+        current = saved;
+    }
+
+    // Start from the context of `node`'s ancestors, for visits that begin somewhere inside a tree.
+    void seedContext(const SyntaxNode &node) {
+        current = {};
+        for (auto parent = node.parent; parent != nullptr; parent = parent->parent) {
+            auto kind = parent->kind;
+            if (current.module == nullptr && ModuleDeclarationSyntax::isKind(kind)) {
+                current.module = &parent->as<ModuleDeclarationSyntax>();
+            } else if (current.module == nullptr && current.procedure == nullptr && ProceduralBlockSyntax::isKind(kind)) {
+                current.procedure = &parent->as<ProceduralBlockSyntax>();
+            } else if (current.module == nullptr && current.generate == nullptr && (GenerateBlockSyntax::isKind(kind) || LoopGenerateSyntax::isKind(kind) || IfGenerateSyntax::isKind(kind) || CaseGenerateSyntax::isKind(kind) || GenerateRegionSyntax::isKind(kind))) {
+                current.generate = parent;
+            } else if (current.module == nullptr && current.function == nullptr && FunctionDeclarationSyntax::isKind(kind)) {
+                current.function = &parent->as<FunctionDeclarationSyntax>();
+            }
+        }
+    }
+
+  private:
+    SyntaxContext current;
+};
+
+// Destination of the text produced by the tree listers. Listers buffer their lines and call write() with large chunks.
+class ListerSink {
+  public:
+    virtual ~ListerSink() = default;
+
+    virtual void write(std::string_view text) = 0;
+
+    virtual void flush() {}
+};
+
+// Collects the listing in memory.
+class MemorySink : public ListerSink {
+  public:
+    std::string buffer;
+
+    void write(std::string_view text) override { buffer.append(text); }
+};
+
+// Writes to a stdio stream. This is what the listers use (on stdout) when no sink is given.
+class FileSink : public ListerSink {
+  public:
+    explicit FileSink(std::FILE *file) : file(file) {}
+
+    void write(std::string_view text) override { std::fwrite(text.data(), 1, text.size(), file); }
+
+    void flush() override { std::fflush(file); }
+
+  private:
+    std::FILE *file;
+};
+
+// Writes to a raw file descriptor, batching the output into one write(2) per `batchSize` bytes.
+class FdSink : public ListerSink {
+  public:
+    explicit FdSink(int fd, size_t batchSize = size_t(1) << 20) : fd(fd), batchSize(batchSize) {}
+
+    ~FdSink() override { flush(); }
+
+    void write(std::string_view text) override;
+
+    void flush() override;
+
+  private:
+    int fd;
+    size_t batchSize;
+    std::string buffer;
+};
+
+// Hands every chunk to a caller-provided callback.
+class CallbackSink : public ListerSink {
+  public:
+    explicit CallbackSink(std::function<void(std::string_view)> callback) : callback(std::move(callback)) {}
+
+    void write(std::string_view text) override { callback(text); }
+
+  private:
+    std::function<void(std::string_view)> callback;
+};
+
+enum class ListFormat {
+    Text, // human-oriented tree art
+
+    // One JSON object per line and node:
+    //   {"id":7,"parent":3,"kind":"NetDeclaration","kindId":N,"category":0,"type":"slang::syntax::NetDeclarationSyntax",
+    //    "depth":2,"name":"","range":[buffer,startOffset,endOffset],"width":0}
+    // "parent" is null for the node the listing starts at, "width" is the bit width of values and expressions (else 0).
+    NDJson,
+
+    // "SLCD", u8 version (1), u8 tree (0 syntax, 1 AST), then one record per node, all integers little-endian:
+    //   u64 id, u64 parent (all ones for the first node), u16 kindId, u8 category, u8 reserved, u32 depth,
+    //   u32 buffer, u32 startOffset, u32 endOffset, u64 width, u32 nameLength, name bytes
+    Binary
+};
+
+// What a structured record's kindId is a value of: SyntaxKind, SymbolKind, StatementKind, ExpressionKind,
+// or (Other) the kind enum of the remaining AST nodes such as timing controls.
+enum class ListRecordCategory : uint8_t { Syntax, Symbol, Statement, Expression, Other };
+
+// Narrows a listing down to the nodes of interest. Empty members match everything, so a default ListFilter lists
+// every node. Nodes that do not match are not printed but still descended into, except for subtrees that cannot
+// contain a match, which are skipped.
+struct ListFilter {
+    // Kinds to print in syntax listings.
+    std::vector<SyntaxKind> syntaxKinds;
+
+    // Kinds to print in AST listings. Statements and expressions are only printed when neither kinds nor a name
+    // pattern are given.
+    std::vector<SymbolKind> symbolKinds;
+
+    // Glob ('*' and '?') and ECMAScript regex the whole node name has to match: the module, declarator or identifier
+    // name of syntax nodes, the symbol name of AST nodes. Nodes without a name have an empty one. An invalid regex
+    // throws std::regex_error.
+    std::string nameGlob;
+    std::string nameRegex;
+
+    // Only list the subtree at this dot-separated path: module declaration names for syntax listings (nested
+    // modules/interfaces/packages as further components), a hierarchical name such as "top.u_core.u_alu" for AST
+    // listings. Nothing is listed (the sink stays empty) and a note goes to stderr if the path does not resolve.
+    std::string rootPath;
+};
+
+struct ListOptions {
+    uint64_t maxDepth = 1000;
+
+    // Where the listing goes, nullptr means stdout.
+    ListerSink *sink = nullptr;
+
+    ListFormat format = ListFormat::Text;
+
+    // Worker threads for listAST, which then lists every compilation unit and every member of a top-level instance
+    // body separately and concatenates the results in order (same output as one thread). 1 lists on the calling thread, 0 uses one
+    // thread per hardware thread. The design is fully elaborated first.
+    unsigned threads = 1;
+
+    ListFilter filter;
+};
+
 void listAST(std::shared_ptr<SyntaxTree> tree, uint64_t maxDepth);
 
+void listAST(std::shared_ptr<SyntaxTree> tree, const ListOptions &options);
+
+// Lists a design that is already elaborated (or will be elaborated once and kept), so several listings and lookups
+// against the same Compilation do not each rebuild it. The compilation's trees must outlive it.
+void listAST(Compilation &compilation, const ListOptions &options = {});
+
 void listSyntaxTree(std::shared_ptr<SyntaxTree> tree, uint64_t maxDepth);
 
+void listSyntaxTree(std::shared_ptr<SyntaxTree> tree, const ListOptions &options);
+
 void listSyntaxNode(const SyntaxNode &node, uint64_t maxDepth);
 
+void listSyntaxNode(const SyntaxNode &node, const ListOptions &options);
+
 void listASTNode(std::shared_ptr<SyntaxTree> tree, const ModuleDeclarationSyntax &syntax, uint64_t maxDepth);
 
+void listASTNode(std::shared_ptr<SyntaxTree> tree, const ModuleDeclarationSyntax &syntax, const ListOptions &options);
+
+class DefaultInstanceCache;
+
+// Creates the default instance anew on each call; prefer the cache overload for repeated listings. Both report on
+// stderr and list nothing if the declaration has no definition in the compilation.
+void listASTNode(Compilation &compilation, const ModuleDeclarationSyntax &syntax, const ListOptions &options = {});
+
+void listASTNode(DefaultInstanceCache &cache, const ModuleDeclarationSyntax &syntax, const ListOptions &options = {});
+
+// Lists the body of an instance that already exists, e.g. one kept by a CompilationSession.
+void listASTNode(const InstanceSymbol &instance, const ListOptions &options = {});
+
+// Size summary of a design, gathered by the same traversals the listers use but without formatting anything.
+struct DesignStats {
+    // Node counts indexed by SyntaxKind / SymbolKind value (sized to the largest kind seen).
+    std::vector<uint64_t> syntaxKindCounts;
+    std::vector<uint64_t> symbolKindCounts;
+
+    uint64_t syntaxNodes    = 0;
+    uint64_t astNodes       = 0; // symbols, statements, expressions and the other AST nodes
+    uint64_t maxSyntaxDepth = 0;
+    uint64_t maxASTDepth    = 0;
+
+    uint64_t instances = 0;
+    uint64_t nets      = 0;
+    uint64_t ports     = 0;
+
+    // Approximate footprint: sizeof() of every visited node, not counting the strings and arrays it points to.
+    uint64_t syntaxBytes = 0;
+    uint64_t astBytes    = 0;
+};
+
+// Syntax statistics only, no elaboration.
+DesignStats collectSyntaxStats(const SyntaxNode &node);
+
+// Syntax statistics of all trees in compilation plus AST statistics of the elaborated design.
+DesignStats collectDesignStats(Compilation &compilation);
+
+DesignStats collectDesignStats(std::shared_ptr<SyntaxTree> tree);
+
+// The result dangles: it points into a Compilation that is destroyed before the function returns, so it must not be
+// dereferenced. Only kept so that existing callers still build; use a CompilationSession or the overload below.
+[[deprecated("the returned symbol dangles, use a CompilationSession or getDefSymbol(Compilation &, ...)")]]
 const DefinitionSymbol *getDefSymbol(std::shared_ptr<SyntaxTree> tree, const ModuleDeclarationSyntax &syntax);
 
+// The returned symbol lives as long as compilation.
+const DefinitionSymbol *getDefSymbol(Compilation &compilation, const ModuleDeclarationSyntax &syntax);
+
+// Creates a new default instance on every call, prefer the DefaultInstanceCache overload in loops. nullptr if the
+// declaration has no definition in the compilation.
 const InstanceSymbol *getInstSymbol(Compilation &compilation, const ModuleDeclarationSyntax &syntax);
 
+// Default instances (parameters at their defaults) of a Compilation, one per definition. slang does not share the
+// instances made by InstanceSymbol::createDefault, so each one allocates and elaborates a fresh body; this cache
+// creates it on the first request and hands out the same instance afterwards.
+//
+// The lock only keeps the cache itself consistent. Creating an instance allocates in and elaborates the compilation,
+// which is not safe while other threads read it, so concurrent users create all instances they need up front (as a
+// concurrent SemanticModel does).
+class DefaultInstanceCache {
+  public:
+    explicit DefaultInstanceCache(Compilation &compilation) : compilation(compilation) {}
+
+    const InstanceSymbol &get(const DefinitionSymbol &definition);
+
+    // nullptr if the declaration has no definition in the compilation.
+    const InstanceSymbol *get(const ModuleDeclarationSyntax &syntax);
+
+    Compilation &getCompilation() const { return compilation; }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return instances.size();
+    }
+
+  private:
+    Compilation &compilation;
+    mutable std::mutex mutex;
+    flat_hash_map<const DefinitionSymbol *, const InstanceSymbol *> instances;
+};
+
+const InstanceSymbol *getInstSymbol(DefaultInstanceCache &cache, const ModuleDeclarationSyntax &syntax);
+
+// Name-keyed index of the definitions (modules, interfaces, programs) and packages declared at the top level of a
+// Compilation's syntax trees, built once. Names view the source text, so the index is valid as long as the trees.
+class DefinitionIndex {
+  public:
+    // A module and a package may share a name, they live in different namespaces.
+    struct Entry {
+        const DefinitionSymbol *definition = nullptr;
+        const PackageSymbol *package       = nullptr;
+    };
+
+    explicit DefinitionIndex(Compilation &compilation);
+
+    const Entry *find(std::string_view name) const;
+
+    const DefinitionSymbol *findDefinition(std::string_view name) const;
+
+    const PackageSymbol *findPackage(std::string_view name) const;
+
+    // All names in ascending order.
+    std::span<const std::string_view> names() const { return sortedNames; }
+
+    // The names starting with prefix, in ascending order.
+    std::span<const std::string_view> withPrefix(std::string_view prefix) const;
+
+    // The names matching a glob (see globMatch), in ascending order. Only the names sharing the pattern's literal
+    // prefix are tested.
+    std::vector<std::string_view> matching(std::string_view glob) const;
+
+  private:
+    flat_hash_map<std::string_view, Entry> entries;
+    std::vector<std::string_view> sortedNames;
+};
+
+// Declared names of modules mapped to their declaration syntax: nets, variables, ports and parameters, every
+// declarator of a declaration included. Only names in the module's own scope are indexed; locals of functions, tasks,
+// classes, begin/end and fork/join blocks and generate blocks are not. A module is indexed on its first lookup;
+// nested modules get their own index.
+class DeclarationIndex {
+  public:
+    // All declarations of name in module in depth-first order, e.g. `input a;` followed by `wire a;`.
+    std::span<const SyntaxNode *const> findAll(const ModuleDeclarationSyntax &module, std::string_view name);
+
+    // The first of them, or the first one of the given kind (e.g. SyntaxKind::NetDeclaration).
+    const SyntaxNode *find(const ModuleDeclarationSyntax &module, std::string_view name, SyntaxKind kind = SyntaxKind::Unknown);
+
+    // Same for the module enclosing node, nullptr if there is none.
+    const SyntaxNode *find(const SyntaxNode &node, std::string_view name, SyntaxKind kind = SyntaxKind::Unknown);
+
+  private:
+    using NameMap = flat_hash_map<std::string_view, std::vector<const SyntaxNode *>>;
+
+    const NameMap &build(const ModuleDeclarationSyntax &module);
+
+    flat_hash_map<const ModuleDeclarationSyntax *, NameMap> modules;
+};
+
+// Searches the whole subtree (or, reversed, the ancestors) on every call, use a DeclarationIndex for repeated lookups.
 const SyntaxNode *getNetDeclarationSyntax(const SyntaxNode *node, std::string_view identifierName, bool reverse = false);
+
+// Matches the whole of text against a glob pattern: '*' matches any sequence, '?' any single character.
+bool globMatch(std::string_view pattern, std::string_view text);
+
+// Calls func(0) ... func(count - 1) on up to `threads` worker threads (0 means one per hardware thread).
+void parallelFor(size_t count, unsigned threads, const std::function<void(size_t)> &func);
 } // namespace slang_common
\ No newline at end of file